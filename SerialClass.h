@@ -21,24 +21,28 @@ class Serial
         //Keep track of last error
         DWORD errors;
 
+    protected:
+        //For subclasses that are not a real port (the simulated camera in sim.cpp)
+        Serial() : hSerial(INVALID_HANDLE_VALUE), connected(false) {}
+
     public:
         //Initialize Serial communication with the given COM port
         Serial(char *portName);
         //Close the connection
         //NOTA: for some reason you can't connect again before exiting
         //the program and running it again
-        ~Serial();
+        virtual ~Serial();
         //Read data in a buffer, if nbChar is greater than the
         //maximum number of bytes available, it will return only the
         //bytes available. The function return -1 when nothing could
         //be read, the number of bytes actually read.
-        int ReadData(char *buffer, unsigned int nbChar);
+        virtual int ReadData(char *buffer, unsigned int nbChar);
         //Writes data from a buffer through the Serial connection
         //return true on success.
-        bool WriteData(char *buffer, unsigned int nbChar);
+        virtual bool WriteData(char *buffer, unsigned int nbChar);
         //Check if we are actually connected
-        bool IsConnected();
-        bool SetSpeed(int speed);	// Use CBR_ constants
+        virtual bool IsConnected();
+        virtual bool SetSpeed(int speed);	// Use CBR_ constants
 };
 
 #endif // SERIALCLASS_H_INCLUDED
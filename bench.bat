@@ -0,0 +1,7 @@
+@echo off
+rem Benchmark "get all" against the simulated camera (virtual time, so this takes seconds)
+rem over the baud rates and a few fault seeds, one line per run appended to bench.csv
+for %%b in (9600 19200 38400 57600 115200) do (
+	dc210 SIM get all tar=nul baud=%%b simlog=bench.csv
+	for %%s in (1 2 3 4 5) do dc210 SIM get all tar=nul baud=%%b noise=0.005 drop=0.001 jitter=20 seed=%%s simlog=bench.csv
+)
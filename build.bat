@@ -1,3 +1,20 @@
 cl /c /EHsc serial.cpp
+cl /c /EHsc clock.cpp
+cl /c /EHsc dc210.cpp
 cl /c /EHsc main.cpp
-cl /Fedc210.exe main.obj serial.obj
\ No newline at end of file
+cl /c /EHsc sink.cpp
+cl /c /EHsc filter.cpp
+cl /c /EHsc faults.cpp
+cl /c /EHsc sim.cpp
+cl /c /EHsc index.cpp
+cl /c /EHsc sched.cpp
+cl /c /EHsc thumb.cpp
+cl /c /EHsc pool.cpp
+cl /c /EHsc jpeg.cpp
+cl /Fedc210.exe main.obj dc210.obj serial.obj clock.obj sink.obj filter.obj faults.obj sim.obj index.obj sched.obj thumb.obj pool.obj jpeg.obj
+
+cl /c /EHsc proxy.cpp
+cl /Fedcproxy.exe proxy.obj serial.obj clock.obj faults.obj
+
+cl /c /EHsc dcindex.cpp
+cl /Fedcindex.exe dcindex.obj index.obj filter.obj
@@ -0,0 +1,44 @@
+// clock.cpp	- Clock used for every timing decision, real or simulated (virtual) time
+
+#include "clock.h"
+
+static bool isVirtual = false;
+static DWORD now = 0;
+static ClockFn listener = NULL;
+static void *listenerCtx = NULL;
+
+DWORD dc_ticks()
+{
+	return isVirtual ? now : GetTickCount();
+}
+
+void dc_sleep(DWORD ms)
+{
+	if (!isVirtual)
+	{
+		Sleep(ms);
+		return;
+	}
+	if (!ms)
+		ms = 1;		// Sleep(0) would spin forever polling for data that is never released
+	if (listener)
+		listener(listenerCtx, now, now + ms);
+	now += ms;
+}
+
+void clock_virtual()
+{
+	isVirtual = true;
+	now = 0;
+}
+
+bool clock_is_virtual()
+{
+	return isVirtual;
+}
+
+void clock_listen(ClockFn fn, void *ctx)
+{
+	listener = fn;
+	listenerCtx = ctx;
+}
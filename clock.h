@@ -0,0 +1,21 @@
+// clock.h	- Clock used for every timing decision, real or simulated (virtual) time
+
+#ifndef CLOCK_H_INCLUDED
+#define CLOCK_H_INCLUDED
+
+#include <windows.h>
+
+// In virtual time dc_sleep() returns at once having moved the clock on, so a session against
+// the simulated camera (sim.cpp) runs as fast as the cpu allows but with the same timings
+
+DWORD dc_ticks();				// ms, replaces GetTickCount()
+void dc_sleep(DWORD ms);		// Replaces Sleep()
+
+void clock_virtual();			// Switch to virtual time (before anything is timed)
+bool clock_is_virtual();
+
+// Called with each step of virtual time, so the simulation can account for where it went
+typedef void (*ClockFn)(void *ctx, DWORD from, DWORD to);
+void clock_listen(ClockFn fn, void *ctx);
+
+#endif // CLOCK_H_INCLUDED
@@ -0,0 +1,333 @@
+// dc210.cpp	- Kodak DC210 camera protocol and table driven command transactions
+// See kdcpi-0.0.3 for comms protocol
+
+// Every command is a transaction of the same shape, so rather than hand coding each one as a
+// sequence of states the table below describes the arguments, response and retry policy and
+// dc_command() runs it. Adding a command is just a line in the table.
+
+#include <stdio.h>
+#include <string.h>
+#include "dc210.h"
+#include "clock.h"
+
+static const DcCommand dc_commands[] =
+{
+	// code						name					args		response		packet	timeout			retries
+	{ DC_SET_SPEED,				"SET_SPEED",			ARGS_WORD,	RESP_ACK,		0,		TIMEOUT_ACK,	1 },
+	{ DC210_INITIALIZE,			"INITIALIZE",			ARGS_NONE,	RESP_COMPLETE,	0,		TIMEOUT_INIT,	2 },
+	{ DC210_STATUS,				"STATUS",				ARGS_NONE,	RESP_DATA,		256,	TIMEOUT_ACK,	2 },
+	{ DC210_PICTURE_INFO,		"PICTURE_INFO",			ARGS_WORD,	RESP_DATA,		256,	TIMEOUT_ACK,	2 },
+	{ DC210_PICTURE_DOWNLOAD,	"PICTURE_DOWNLOAD",		ARGS_WORD,	RESP_DATA,		1024,	TIMEOUT_ACK,	2 },
+	{ DC210_PICTURE_THUMBNAIL,	"PICTURE_THUMBNAIL",	ARGS_WORD,	RESP_DATA,		1024,	TIMEOUT_ACK,	2 },
+	{ DC210_TAKE_PICTURE,		"TAKE_PICTURE",			ARGS_NONE,	RESP_COMPLETE,	0,		TIMEOUT_BUSY,	1 },
+	{ DC210_ERASE,				"ERASE",				ARGS_NONE,	RESP_COMPLETE,	0,		TIMEOUT_BUSY,	1 },
+	{ DC210_ERASE_IMAGE_IN_CARD,"ERASE_IMAGE_IN_CARD",	ARGS_WORD,	RESP_COMPLETE,	0,		TIMEOUT_BUSY,	1 },
+	{ DC210_SET_RESOLUTION,		"SET_RESOLUTION",		ARGS_BYTE,	RESP_COMPLETE,	0,		TIMEOUT_ACK,	2 },
+	// NB DC210_SET_CAMERA_ID sends a data packet to the camera, which is not a shape handled here
+};
+
+const DcCommand *dc_lookup(int code)
+{
+	for (int i=0; i<(int)(sizeof(dc_commands)/sizeof(dc_commands[0])); i++)
+		if (dc_commands[i].code == code)
+			return &dc_commands[i];
+	return NULL;
+}
+
+const char *dc_error(int err)
+{
+	switch (err)
+	{
+		case DC_OK:				return "OK";
+		case DC_ERR_TIMEOUT:	return "timeout";
+		case DC_ERR_NAK:		return "NAK";
+		case DC_ERR_PROTOCOL:	return "unexpected response";
+		case DC_ERR_CHECKSUM:	return "bad checksum";
+		case DC_ERR_CANCELLED:	return "cancelled";
+		case DC_ERR_UNKNOWN:	return "unknown command";
+		case DC_ERR_LENGTH:		return "wrong length";
+	}
+	return "error";
+}
+
+void send_command(Serial* SP, int cmd, int arg1, int arg2, int arg3, int arg4)
+{
+	// All commands are 8 bytes
+	// my $data = pack("C8",$command,0x00,$arg1,$arg2,$arg3,$arg4,0x00,0x1A);
+	char outData[8] = { (char)cmd, 0x00, (char)arg1, (char)arg2, (char)arg3, (char)arg4, 0x00, 0x1A };
+	(VERBOSITY > 1) && myprintf("send_command %02X\n", cmd);
+	SP->WriteData(outData,8);	// NB do NOT use strlen to get length due to nulls
+}
+
+static void send_byte(Serial* SP, int c)
+{
+	char b = (char)c;
+	SP->WriteData(&b,1);
+}
+
+static void drain(Serial* SP)
+{
+	char buf[256];
+	while (SP->ReadData(buf,sizeof(buf)) > 0)
+		;
+}
+
+static void settle(Serial* SP, int ms)
+{
+	// Discard everything until the line has been quiet for ms, a packet at 9600 takes over a second
+	char buf[256];
+	DWORD last = dc_ticks();
+	while (dc_ticks() - last < (DWORD)ms)
+	{
+		if (SP->ReadData(buf,sizeof(buf)) > 0)
+			last = dc_ticks();
+		else
+			dc_sleep(5);
+	}
+}
+
+int read_wait(Serial* SP, char *buf, int len, int ms)
+{
+	// Read len bytes, giving up after ms with nothing arriving. Returns the number read
+	int got = 0;
+	DWORD last = dc_ticks();
+	while (got < len)
+	{
+		int n = SP->ReadData(buf+got, len-got);
+		if (n > 0)
+		{
+			got += n;
+			last = dc_ticks();
+		}
+		else if (dc_ticks() - last > (DWORD)ms)
+			break;
+		else
+			dc_sleep(5);
+	}
+	return got;
+}
+
+static int read_byte(Serial* SP, int ms)
+{
+	char c;
+	return read_wait(SP, &c, 1, ms) == 1 ? (unsigned char)c : -1;
+}
+
+static int read_unbusy(Serial* SP, int ms)
+{
+	// Next byte that is not DC_BUSY, -1 if none in ms. DC_BUSY shows progress but only for ms in all
+	DWORD start = dc_ticks();
+	int c = read_byte(SP, ms);
+	while (c == DC_BUSY && dc_ticks() - start <= (DWORD)ms)
+		c = read_byte(SP, ms);
+	return c == DC_BUSY ? -1 : c;
+}
+
+static int wait_for(Serial* SP, int want, int ms)
+{
+	// Wait for the want byte, polling through DC_BUSY for up to ms in total
+	DWORD start = dc_ticks();
+	while (1)
+	{
+		int c = read_byte(SP, ms);
+		if (c == want)
+			return DC_OK;
+		if (c < 0)
+			return DC_ERR_TIMEOUT;
+		if (c == DC_COMMAND_NAK)
+			return DC_ERR_NAK;
+		if (c != DC_BUSY)
+		{
+			(VERBOSITY > -1) && myprintf("... UNEXPECTED %02X\n", c);
+			return DC_ERR_PROTOCOL;
+		}
+		if (dc_ticks() - start > (DWORD)ms)
+			return DC_ERR_TIMEOUT;
+		(VERBOSITY > 1) && myprintf("... BUSY\n");
+	}
+}
+
+static int read_packets(Serial* SP, const DcCommand *cmd, char *data, int length, PacketFn fn, void *ctx)
+{
+	// Each packet is PKT_CTRL_RECV, packetSize bytes, then a checksum (xor of the data). We answer
+	// DC_ILLEGAL_PACKET to have it sent again, else DC_CORRECT_PACKET (or PKT_CTRL_CANCEL to stop).
+	// The camera decides how many there are, DC_COMMAND_COMPLETE follows the last
+	char pkt[1024+1];
+	int size = cmd->packetSize;
+	int packets = (length + size - 1) / size;
+
+	for (int p=0; p<packets; p++)
+	{
+		int err = DC_ERR_CHECKSUM;
+		for (int attempt=0; attempt<=cmd->retries && err != DC_OK; attempt++)
+		{
+			int c = read_unbusy(SP, cmd->timeout);
+			if (c < 0)
+				return DC_ERR_TIMEOUT;
+			if (c == DC_COMMAND_COMPLETE && read_byte(SP, TIMEOUT_QUIET) < 0)
+			{
+				// The camera has sent all it has (a packet would follow straight on, this is not noise)
+				(VERBOSITY > -1) && myprintf("... %s ended after %d packets, expected %d\n", cmd->name, p, packets);
+				return DC_ERR_LENGTH;
+			}
+			if (c != PKT_CTRL_RECV && c != PKT_CTRL_EOF)
+			{
+				(VERBOSITY > -1) && myprintf("... UNEXPECTED %02X, expected packet\n", c);
+				return DC_ERR_PROTOCOL;
+			}
+			if (read_wait(SP, pkt, size+1, TIMEOUT_PACKET) != size+1)
+			{
+				// A byte lost on the line, ask again as for a bad checksum once the rest is in
+				(VERBOSITY > -1) && myprintf("SHORT %s packet %d, asking for it again\n", cmd->name, p);
+				drain(SP);
+				send_byte(SP, DC_ILLEGAL_PACKET);
+				err = DC_ERR_TIMEOUT;
+				continue;
+			}
+
+			int checksum = 0;
+			for (int i=0; i<size; i++)
+				checksum ^= pkt[i];
+			if ((checksum & 0xFF) == (pkt[size] & 0xFF))
+				err = DC_OK;
+			else
+			{
+				(VERBOSITY > -1) && myprintf("BAD CHECKSUM %s packet %d, asking for it again\n", cmd->name, p);
+				send_byte(SP, DC_ILLEGAL_PACKET);
+			}
+		}
+		if (err)
+			return err;
+
+		if (data)
+			memcpy(data + p*size, pkt, size);
+		if (fn && !fn(ctx, pkt, size, p*size))
+		{
+			(VERBOSITY > 0) && myprintf("Cancelling %s\n", cmd->name);
+			send_byte(SP, PKT_CTRL_CANCEL);
+			wait_for(SP, DC_COMMAND_COMPLETE, TIMEOUT_ACK);	// Camera may or may not confirm
+			drain(SP);
+			return DC_ERR_CANCELLED;
+		}
+		send_byte(SP, DC_CORRECT_PACKET);
+	}
+
+	int c = read_unbusy(SP, cmd->timeout);
+	if (c == PKT_CTRL_RECV || c == PKT_CTRL_EOF)
+	{
+		// More than expected, take the packet to have the line back in step and stop there
+		(VERBOSITY > -1) && myprintf("... %s longer than %d packets, cancelling\n", cmd->name, packets);
+		if (read_wait(SP, pkt, size+1, TIMEOUT_PACKET) != size+1)
+			return DC_ERR_PROTOCOL;		// Was noise
+		send_byte(SP, PKT_CTRL_CANCEL);
+		wait_for(SP, DC_COMMAND_COMPLETE, TIMEOUT_ACK);
+		drain(SP);
+		return DC_ERR_LENGTH;
+	}
+	if (c < 0)
+		return DC_ERR_TIMEOUT;
+	if (c == DC_COMMAND_NAK)
+		return DC_ERR_NAK;
+	if (c != DC_COMMAND_COMPLETE)
+	{
+		(VERBOSITY > -1) && myprintf("... UNEXPECTED %02X\n", c);
+		return DC_ERR_PROTOCOL;
+	}
+	return DC_OK;
+}
+
+int dc_command(Serial* SP, int code, int a, int b, char *data, int length, PacketFn fn, void *ctx)
+{
+	const DcCommand *cmd = dc_lookup(code);
+	if (!cmd)
+		return DC_ERR_UNKNOWN;
+
+	int arg1 = 0, arg2 = 0, arg3 = 0;
+	if (cmd->args == ARGS_WORD)
+	{
+		arg1 = (a >> 8) & 0xFF;		// NB arg1=msb arg2=lsb
+		arg2 = a & 0xFF;
+		arg3 = b & 0xFF;
+	}
+	else if (cmd->args == ARGS_BYTE)
+		arg1 = a & 0xFF;
+
+	int err = DC_ERR_NAK;
+	for (int attempt=0; attempt<=cmd->retries && err == DC_ERR_NAK; attempt++)
+	{
+		drain(SP);		// Anything left over is stale
+		(VERBOSITY > 0) && myprintf("%s\n", cmd->name);
+		send_command(SP, code, arg1, arg2, arg3, 0);
+		err = wait_for(SP, DC_COMMAND_ACK, cmd->timeout);
+	}
+	if (err)
+		return err;
+
+	if (cmd->response == RESP_ACK)
+		return DC_OK;
+	if (cmd->response == RESP_DATA)
+		return read_packets(SP, cmd, data, length, fn, ctx);	// Through to DC_COMMAND_COMPLETE
+	return wait_for(SP, DC_COMMAND_COMPLETE, cmd->timeout);
+}
+
+int dc_set_speed(Serial* SP, int speed, int *portSpeed)
+{
+	int code;
+	switch (speed)
+	{
+		case CBR_9600:		code = 0x9600; break;
+		case CBR_19200:		code = 0x1920; break;
+		case CBR_38400:		code = 0x3840; break;
+		case CBR_57600:		code = 0x5760; break;
+		case CBR_115200:	code = 0x1152; break;
+		default:			return DC_ERR_UNKNOWN;
+	}
+	int err = dc_command(SP, DC_SET_SPEED, code, 0, NULL, 0, NULL, NULL);
+	if (err)
+		return err;
+	SP->SetSpeed(speed);
+	*portSpeed = speed;
+	// CARE may need to power cycle camera if program aborts since still in high speed mode
+	return DC_OK;
+}
+
+int dc_recover(Serial* SP, int *portSpeed)
+{
+	// Abandon whatever the camera was doing, find the baud rate it is at and return it to 9600
+	// so the session can be restarted without a power cycle
+	(VERBOSITY > -1) && myprintf("Recovering session\n");
+
+	send_byte(SP, PKT_CTRL_CANCEL);
+
+	int speeds[3] = { *portSpeed, CBR_115200, CBR_9600 };
+	for (int i=0; i<3; i++)
+	{
+		int tried = 0;
+		for (int j=0; j<i; j++)
+			if (speeds[j] == speeds[i])
+				tried = 1;
+		if (tried)
+			continue;
+		// The rest of any packet in flight, or the late reply to the last probe, would be taken
+		// as the answer to this one
+		settle(SP, 500);
+		SP->SetSpeed(speeds[i]);
+		*portSpeed = speeds[i];
+		(VERBOSITY > 0) && myprintf("Probing at %d baud\n", speeds[i]);
+		if (dc_command(SP, DC210_INITIALIZE, 0, 0, NULL, 0, NULL, NULL) != DC_OK)
+			continue;
+
+		if (speeds[i] != CBR_9600 && dc_set_speed(SP, CBR_9600, portSpeed) != DC_OK)
+		{
+			SP->SetSpeed(CBR_9600);		// Assume it took, as at exit
+			*portSpeed = CBR_9600;
+		}
+		(VERBOSITY > -1) && myprintf("Camera found at %d baud\n", speeds[i]);
+		return 1;
+	}
+
+	// Leave port at 9600 for the final speed reset
+	SP->SetSpeed(CBR_9600);
+	*portSpeed = CBR_9600;
+	return 0;
+}
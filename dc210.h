@@ -0,0 +1,118 @@
+// dc210.h	- Kodak DC210 camera protocol and table driven command transactions
+// See kdcpi-0.0.3 for comms protocol
+
+#ifndef DC210_H_INCLUDED
+#define DC210_H_INCLUDED
+
+#include "SerialClass.h"
+
+// CONFIGURATION
+
+#define VERBOSITY 0		// 0, 1, 2 (for debugging)
+
+// From kdcpi-0.0.3
+// Control bytes
+#define PKT_CTRL_RECV    0x01
+#define PKT_CTRL_SEND    0x00
+#define PKT_CTRL_EOF     0x80
+#define PKT_CTRL_CANCEL  0xFF
+
+// Kodak System Codes
+#define DC_COMMAND_COMPLETE  0x00
+#define DC_COMMAND_ACK       0xD1
+#define DC_CORRECT_PACKET    0xD2
+#define DC_COMMAND_NAK       0xE1
+#define DC_ILLEGAL_PACKET    0xE3
+#define DC_BUSY              0xF0
+
+// Commands common to all implemented Kodak cameras
+#define DC_SET_SPEED         0x41
+
+// DC210
+#define DC210_LOW_RES_THUMBNAIL 0
+#define DC210_HIGH_RES_THUMBNAIL 1
+#define DC210_EPOC 852094800
+#define DC210_TICKS_PER_SEC 2	// Camera clock counts half seconds from DC210_EPOC (as kdcpi)
+
+// STATUS batteryStatusId and acStatusId
+#define DC210_BATTERY_OK     0
+#define DC210_BATTERY_LOW    1
+#define DC210_BATTERY_EMPTY  2
+#define DC210_AC_CONNECTED   1
+
+// Kodak System Commands
+#define DC210_SET_RESOLUTION      0x36
+#define DC210_PICTURE_DOWNLOAD    0x64
+#define DC210_PICTURE_INFO        0x65
+#define DC210_PICTURE_THUMBNAIL   0x66
+#define DC210_SET_SOMETHING       0x75
+#define DC210_TAKE_PICTURE        0x7C
+#define DC210_ERASE               0x7A
+#define DC210_ERASE_IMAGE_IN_CARD 0x7B
+#define DC210_INITIALIZE          0x7E
+#define DC210_STATUS              0x7F
+#define DC210_SET_CAMERA_ID       0x9E
+
+// Timeouts, ms without any byte from the camera (DC_BUSY bytes count as progress)
+#define TIMEOUT_ACK     3000		// Single byte responses
+#define TIMEOUT_INIT    10000		// INITIALIZE
+#define TIMEOUT_PACKET  3000		// Within a data packet
+#define TIMEOUT_BUSY    30000		// TAKE_PICTURE, ERASE
+#define TIMEOUT_QUIET   100			// Nothing after a byte, the camera has stopped sending
+
+// Response shapes
+#define RESP_ACK        0	// Single ACK byte (DC_SET_SPEED)
+#define RESP_COMPLETE   1	// ACK, DC_BUSY while working, DC_COMMAND_COMPLETE
+#define RESP_DATA       2	// ACK, then packets of PKT_CTRL_RECV + data + checksum, each answered
+							// with DC_CORRECT_PACKET, then DC_COMMAND_COMPLETE
+
+// Argument layouts, the command is always 8 bytes: cmd 0x00 arg1 arg2 arg3 arg4 0x00 0x1A
+#define ARGS_NONE       0
+#define ARGS_WORD       1	// a as big-endian word in arg1/arg2 (picture number, speed code), b in arg3
+#define ARGS_BYTE       2	// a in arg1
+
+struct DcCommand
+{
+	int code;
+	const char *name;
+	int args;			// ARGS_
+	int response;		// RESP_
+	int packetSize;		// RESP_DATA only
+	int timeout;		// For the ACK and COMPLETE
+	int retries;		// On NAK or bad packet checksum
+};
+
+// Result codes
+#define DC_OK              0
+#define DC_ERR_TIMEOUT    -1
+#define DC_ERR_NAK        -2
+#define DC_ERR_PROTOCOL   -3
+#define DC_ERR_CHECKSUM   -4
+#define DC_ERR_CANCELLED  -5
+#define DC_ERR_UNKNOWN    -6	// Not in command table
+#define DC_ERR_LENGTH     -7	// More or fewer packets than expected, the line is left clean
+
+// Called as each data packet arrives, offset is of the packet within the whole transfer (the last
+// packet is padded to packetSize). Return false to abandon the transfer with PKT_CTRL_CANCEL
+typedef bool (*PacketFn)(void *ctx, const char *data, int len, int offset);
+
+const DcCommand *dc_lookup(int code);
+const char *dc_error(int err);
+
+// Run one command to completion. For RESP_DATA, length is the number of bytes expected (rounded
+// up to whole packets), data (may be NULL) must have room for the padded length. A transfer of
+// any other number of packets is DC_ERR_LENGTH
+int dc_command(Serial* SP, int code, int a, int b, char *data, int length, PacketFn fn, void *ctx);
+
+// DC_SET_SPEED then switch the port to match, speed is a CBR_ constant
+int dc_set_speed(Serial* SP, int speed, int *portSpeed);
+
+// Cancel whatever the camera was doing, find the baud rate it is at and return it to 9600
+int dc_recover(Serial* SP, int *portSpeed);
+
+void send_command(Serial* SP, int cmd, int arg1, int arg2, int arg3, int arg4);
+int read_wait(Serial* SP, char *buf, int len, int ms);
+
+int myprintf(char *fmt, ...);	// main.cpp
+
+#endif // DC210_H_INCLUDED
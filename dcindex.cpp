@@ -0,0 +1,367 @@
+// dcindex.cpp	- Query the index of downloaded pictures written by dc210 (see index.h)
+
+// Answers "where did this file come from" and "which pictures match" from the index alone, so the
+// picture archive is never walked. Lookups go through a key file (INDEX.key) holding the record
+// numbers sorted by file name and by time taken, searched in place. The key file is rebuilt
+// whenever the index has grown since it was written.
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <tchar.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "index.h"
+#include "filter.h"
+
+#define KEY_MAGIC	"DC210KEY"
+#define KEY_HEADER	16			// Magic, records covered
+#define NAME_KEY	16			// Upper case file name (12), record number
+#define TIME_KEY	8			// Taken, record number
+
+struct NameKey
+{
+	char name[12];
+	unsigned long recno;
+	bool operator<(const NameKey &k) const
+	{
+		int c = memcmp(name, k.name, sizeof(name));
+		return c < 0 || (c == 0 && recno < k.recno);
+	}
+};
+
+struct TimeKey
+{
+	unsigned long taken;
+	unsigned long recno;
+	bool operator<(const TimeKey &k) const
+	{
+		return taken < k.taken || (taken == k.taken && recno < k.recno);
+	}
+};
+
+void usage()
+{
+	printf("Usage: dcindex [index=FILE] file NAME|PATH [size=N]  which camera and session produced a file\n");
+	printf("       dcindex [index=FILE] find [camera=TEXT] [filters]  pictures matching all of them\n");
+	printf("       dcindex [index=FILE] sessions [camera=TEXT]        one line per session\n");
+	printf("       dcindex [index=FILE] rebuild                      rewrite the key file\n");
+	printf("Filters as dc210: after=T before=T (T is YYYY-MM-DD[THH:MM[:SS]] or -30m -2h -7d), today,\n");
+	printf("  res=hi|lo, comp=N. The index defaults to %s\n", INDEX_DEFAULT);
+	exit(1);
+}
+
+static void put32(unsigned char *p, unsigned long v)
+{
+	p[0] = (unsigned char)(v & 0xFF);
+	p[1] = (unsigned char)((v >> 8) & 0xFF);
+	p[2] = (unsigned char)((v >> 16) & 0xFF);
+	p[3] = (unsigned char)((v >> 24) & 0xFF);
+}
+
+static unsigned long get32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+static void key_name(char *key, const char *name)
+{
+	// File names are compared case blind, padded with nulls to 12
+	memset(key, 0, 12);
+	for (int i=0; i<12 && name[i]; i++)
+		key[i] = toupper((unsigned char)name[i]);
+}
+
+static bool write_keys(const char *keypath, FILE *idx, long count)
+{
+	printf("Updating %s (%ld pictures)\n", keypath, count);
+	std::vector<NameKey> names(count);
+	std::vector<TimeKey> times(count);
+	IndexEntry e;
+	for (long i=0; i<count; i++)
+	{
+		if (!index_read(idx, i, &e))
+			return false;
+		key_name(names[i].name, e.fileName);
+		names[i].recno = i;
+		times[i].taken = e.taken;
+		times[i].recno = i;
+	}
+	std::sort(names.begin(), names.end());
+	std::sort(times.begin(), times.end());
+
+	FILE *f = fopen(keypath, "wb");
+	if (!f)
+		return false;
+	unsigned char buf[NAME_KEY];
+	memset(buf, 0, sizeof(buf));
+	memcpy(buf, KEY_MAGIC, 8);
+	put32(buf+8, count);
+	bool ok = fwrite(buf, 1, KEY_HEADER, f) == KEY_HEADER;
+	for (long i=0; ok && i<count; i++)
+	{
+		memcpy(buf, names[i].name, 12);
+		put32(buf+12, names[i].recno);
+		ok = fwrite(buf, 1, NAME_KEY, f) == NAME_KEY;
+	}
+	for (long i=0; ok && i<count; i++)
+	{
+		put32(buf, times[i].taken);
+		put32(buf+4, times[i].recno);
+		ok = fwrite(buf, 1, TIME_KEY, f) == TIME_KEY;
+	}
+	return fclose(f) == 0 && ok;
+}
+
+static FILE *open_keys(const char *keypath, FILE *idx, long count, bool rebuild)
+{
+	// The key file, rebuilt first if it doesn't cover the whole index
+	unsigned char hdr[KEY_HEADER];
+	FILE *f = rebuild ? NULL : fopen(keypath, "rb");
+	if (f && fread(hdr, 1, KEY_HEADER, f) == KEY_HEADER && !memcmp(hdr, KEY_MAGIC, 8) &&
+		(long)get32(hdr+8) == count)
+		return f;
+	if (f)
+		fclose(f);
+	if (!write_keys(keypath, idx, count))
+	{
+		printf("ERROR writing %s\n", keypath);
+		exit(1);
+	}
+	return fopen(keypath, "rb");
+}
+
+static void read_name_key(FILE *keys, long i, char *name, unsigned long *recno)
+{
+	unsigned char buf[NAME_KEY];
+	fseek(keys, KEY_HEADER + i * NAME_KEY, SEEK_SET);
+	fread(buf, 1, NAME_KEY, keys);
+	memcpy(name, buf, 12);
+	*recno = get32(buf+12);
+}
+
+static void read_time_key(FILE *keys, long count, long i, unsigned long *taken, unsigned long *recno)
+{
+	unsigned char buf[TIME_KEY];
+	fseek(keys, KEY_HEADER + count * NAME_KEY + i * TIME_KEY, SEEK_SET);
+	fread(buf, 1, TIME_KEY, keys);
+	*taken = get32(buf);
+	*recno = get32(buf+4);
+}
+
+static const char *fmt_time(unsigned long t)
+{
+	static char buf[2][32];		// Two per printf
+	static int which = 0;
+	char *s = buf[which ^= 1];
+	time_t tt = t;
+	struct tm *tm = localtime(&tt);
+	if (!tm || !strftime(s, sizeof(buf[0]), "%Y-%m-%d %H:%M:%S", tm))
+		strcpy(s, "?");
+	return s;
+}
+
+static void print_entry(const IndexEntry *e)
+{
+	static const char *kinds[] = { "dir", "tar", "zip" };	// SINK_
+	printf("%-12s %7lu %s comp %d taken %s  camera \"%s\" session %s  picture %d of %d shots  %s %s\n",
+		e->fileName, e->size, e->resolution ? "hi" : "lo", e->compression, fmt_time(e->taken),
+		e->camera, fmt_time(e->session), e->picnum, e->totalTaken,
+		e->sinkType >= 0 && e->sinkType <= 2 ? kinds[e->sinkType] : "?", e->archive);
+}
+
+static bool camera_match(const char *camera, const char *want)
+{
+	// Case blind substring, NULL matches everything
+	if (!want)
+		return true;
+	std::string c(camera), w(want);
+	for (size_t i=0; i<c.size(); i++)
+		c[i] = toupper((unsigned char)c[i]);
+	for (size_t i=0; i<w.size(); i++)
+		w[i] = toupper((unsigned char)w[i]);
+	return c.find(w) != std::string::npos;
+}
+
+int find_file(FILE *idx, FILE *keys, long count, const char *path, long size)
+{
+	// Binary search the name keys, then check the size if we know it
+	const char *base = path;
+	for (const char *p=path; *p; p++)
+		if (*p == '\\' || *p == '/' || *p == ':')
+			base = p + 1;
+	FILE *f = size < 0 ? fopen(path, "rb") : NULL;
+	if (f)
+	{
+		fseek(f, 0, SEEK_END);
+		size = ftell(f);
+		fclose(f);
+	}
+
+	char want[12], name[12];
+	unsigned long recno;
+	key_name(want, base);
+	long lo = 0, hi = count;
+	while (lo < hi)
+	{
+		long mid = lo + (hi - lo) / 2;
+		read_name_key(keys, mid, name, &recno);
+		if (memcmp(name, want, 12) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	int found = 0, othersize = 0;
+	IndexEntry e;
+	for (long i=lo; i<count; i++)
+	{
+		read_name_key(keys, i, name, &recno);
+		if (memcmp(name, want, 12))
+			break;
+		if (!index_read(idx, recno, &e))
+			break;
+		if (size >= 0 && e.size != (unsigned long)size)
+		{
+			othersize++;
+			continue;
+		}
+		print_entry(&e);
+		found++;
+	}
+	if (othersize)
+		printf("%d more %s of another size\n", othersize, base);
+	if (!found)
+		printf("%s not in index\n", base);
+	return found ? 0 : 1;
+}
+
+int find_pictures(FILE *idx, FILE *keys, long count, const PicFilter *filter, const char *camera)
+{
+	// Binary search the time keys for the start of the range, then walk it
+	long lo = 0, hi = count;
+	unsigned long taken, recno;
+	while (lo < hi)
+	{
+		long mid = lo + (hi - lo) / 2;
+		read_time_key(keys, count, mid, &taken, &recno);
+		if ((long)taken < filter->after)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	int found = 0;
+	IndexEntry e;
+	for (long i=lo; i<count; i++)
+	{
+		read_time_key(keys, count, i, &taken, &recno);
+		if (filter->before && (long)taken > filter->before)
+			break;
+		if (!index_read(idx, recno, &e))
+			break;
+		if (filter_match(filter, e.resolution, e.compression, e.taken) && camera_match(e.camera, camera))
+		{
+			print_entry(&e);
+			found++;
+		}
+	}
+	printf("%d pictures\n", found);
+	return 0;
+}
+
+int list_sessions(FILE *idx, long count, const char *camera)
+{
+	// Records are appended as they are downloaded so a session is a run of them
+	IndexEntry e, first;
+	int pictures = 0;
+	unsigned long bytes = 0;
+	for (long i=0; i<=count; i++)
+	{
+		bool more = i < count && index_read(idx, i, &e);
+		if (pictures && (!more || e.session != first.session || strcmp(e.camera, first.camera)))
+		{
+			if (camera_match(first.camera, camera))
+				printf("%s  camera \"%s\"  %d pictures  %lu bytes  %s\n", fmt_time(first.session),
+					first.camera, pictures, bytes, first.archive);
+			pictures = 0;
+			bytes = 0;
+		}
+		if (!more)
+			break;
+		if (!pictures)
+			first = e;
+		pictures++;
+		bytes += e.size;
+	}
+	return 0;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	const char *path = INDEX_DEFAULT;
+	int a = 1;
+	if (a < argc && !_strnicmp(argv[a], "index=", 6) && argv[a][6])
+		path = argv[a++] + 6;
+	if (a >= argc)
+		usage();
+	const char *cmd = argv[a++];
+
+	PicFilter filter;
+	filter_init(&filter);
+	const char *camera = NULL;
+	long size = -1;
+	const char *file = NULL;
+	for (int i=a; i<argc; i++)
+	{
+		int r = filter_option(&filter, argv[i]);
+		if (r < 0 || (r && filter.last))
+		{
+			printf("Invalid filter \"%s\"\n", argv[i]);
+			usage();
+		}
+		else if (r)
+			;
+		else if (!_strnicmp(argv[i], "camera=", 7))
+			camera = argv[i] + 7;
+		else if (!_strnicmp(argv[i], "size=", 5) && atol(argv[i]+5) > 0)
+			size = atol(argv[i]+5);
+		else if (!file && !_stricmp(cmd, "file"))
+			file = argv[i];
+		else
+			usage();
+	}
+
+	long count;
+	FILE *idx = index_open(path, &count);
+	if (!idx)
+	{
+		printf("ERROR %s missing or not a dc210 index\n", path);
+		return 1;
+	}
+
+	int result = 0;
+	std::string keypath = std::string(path) + ".key";
+	if (!_stricmp(cmd, "sessions"))
+		result = list_sessions(idx, count, camera);
+	else if (!_stricmp(cmd, "rebuild"))
+		fclose(open_keys(keypath.c_str(), idx, count, true));
+	else if (!_stricmp(cmd, "file") && file)
+	{
+		FILE *keys = open_keys(keypath.c_str(), idx, count, false);
+		result = find_file(idx, keys, count, file, size);
+		fclose(keys);
+	}
+	else if (!_stricmp(cmd, "find"))
+	{
+		FILE *keys = open_keys(keypath.c_str(), idx, count, false);
+		result = find_pictures(idx, keys, count, &filter, camera);
+		fclose(keys);
+	}
+	else
+		usage();
+	fclose(idx);
+	return result;
+}
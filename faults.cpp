@@ -0,0 +1,186 @@
+// faults.cpp	- Fault injection for a serial byte stream (line noise, drops, latency, fragmentation, DC_BUSY)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "faults.h"
+
+#define FAULT_ACK  0xD1		// DC_COMMAND_ACK
+#define FAULT_BUSY 0xF0		// DC_BUSY
+
+void faults_init(FaultConfig *cfg)
+{
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->busylen = 3;
+	cfg->seed = 1;
+}
+
+int faults_option(FaultConfig *cfg, const char *arg)
+{
+	const char *val = strchr(arg, '=');
+	if (!val)
+		return 0;
+	val++;
+	double d = atof(val);
+	int n = atoi(val);
+
+	// Not ours unless the key matches, other options (after=-2h) may well be negative
+	static const char *keys[] = { "noise=", "drop=", "delay=", "jitter=", "ackdelay=", "frag=", "busy=", "busylen=", "seed=" };
+	int known = 0;
+	for (int i=0; i<(int)(sizeof(keys)/sizeof(keys[0])); i++)
+		if (!_strnicmp(arg, keys[i], strlen(keys[i])))
+			known = 1;
+	if (!known)
+		return 0;
+	if (d < 0)
+		return -1;
+
+	if (!_strnicmp(arg, "noise=", 6))
+		cfg->noise = d;
+	else if (!_strnicmp(arg, "drop=", 5))
+		cfg->drop = d;
+	else if (!_strnicmp(arg, "delay=", 6))
+		cfg->delay = n;
+	else if (!_strnicmp(arg, "jitter=", 7))
+		cfg->jitter = n;
+	else if (!_strnicmp(arg, "ackdelay=", 9))
+		cfg->ackdelay = n;
+	else if (!_strnicmp(arg, "frag=", 5))
+		cfg->frag = n;
+	else if (!_strnicmp(arg, "busy=", 5))
+		cfg->busy = d;
+	else if (!_strnicmp(arg, "busylen=", 8))
+		cfg->busylen = n;
+	else if (!_strnicmp(arg, "seed=", 5))
+		cfg->seed = n;
+	else
+		return 0;
+	return 1;
+}
+
+void faults_describe(const FaultConfig *cfg, char *buf, int len)
+{
+	_snprintf(buf, len, "noise=%g drop=%g delay=%d jitter=%d ackdelay=%d frag=%d busy=%g busylen=%d seed=%u",
+			cfg->noise, cfg->drop, cfg->delay, cfg->jitter, cfg->ackdelay, cfg->frag, cfg->busy, cfg->busylen, cfg->seed);
+	buf[len-1] = 0;
+}
+
+FaultInjector::FaultInjector(const FaultConfig *config)
+{
+	cfg = *config;
+	rnd = cfg.seed ? cfg.seed : 1;
+	lastRelease = 0;
+	expectReply = false;
+	ResetStats();
+}
+
+unsigned int FaultInjector::Random()
+{
+	// xorshift32, repeatable for a given seed unlike rand()
+	rnd ^= rnd << 13;
+	rnd ^= rnd >> 17;
+	rnd ^= rnd << 5;
+	return rnd;
+}
+
+bool FaultInjector::Chance(double percent)
+{
+	return percent > 0 && (Random() % 1000000) < percent * 10000;
+}
+
+void FaultInjector::ResetStats()
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+void FaultInjector::Command()
+{
+	expectReply = true;
+}
+
+void FaultInjector::Put(const char *data, int len, unsigned long now)
+{
+	std::string out;
+	bool ackFirst = false;		// Chunk starts with the ACK of a command
+	stats.bytes += len;
+	for (int i=0; i<len; i++)
+	{
+		char c = data[i];
+		bool reply = expectReply;
+		expectReply = false;
+		if (Chance(cfg.drop))
+		{
+			stats.dropped++;
+			continue;
+		}
+		if (Chance(cfg.noise))
+		{
+			c ^= 1 << (Random() % 8);
+			stats.corrupted++;
+		}
+		out += c;
+		if (!reply || (unsigned char)c != FAULT_ACK)
+			continue;
+		if (out.size() == 1)
+			ackFirst = true;
+		if (Chance(cfg.busy))
+		{
+			out.append(cfg.busylen, (char)FAULT_BUSY);
+			stats.busy++;
+		}
+	}
+	if (out.empty())
+		return;
+
+	unsigned long delay = cfg.delay + (cfg.jitter ? Random() % (cfg.jitter + 1) : 0);
+	if (ackFirst)
+		delay += cfg.ackdelay;
+	stats.delayms += delay;
+
+	// Keep order, a chunk can't overtake the previous one however the jitter falls
+	unsigned long release = now + delay;
+	if ((long)(release - lastRelease) < 0)
+		release = lastRelease;
+
+	size_t pos = 0;
+	while (pos < out.size())
+	{
+		size_t n = out.size() - pos;
+		if (cfg.frag > 0)
+		{
+			size_t piece = 1 + Random() % cfg.frag;
+			if (piece < n)
+			{
+				n = piece;
+				stats.fragments++;
+			}
+		}
+		Chunk ch;
+		ch.release = release;
+		ch.data = out.substr(pos, n);
+		pending.push_back(ch);
+		pos += n;
+		if (cfg.frag > 0)
+			release++;		// Fragments trickle out a ms apart so the reader sees partial data
+	}
+	lastRelease = release;
+}
+
+int FaultInjector::Get(char *buf, int max, unsigned long now)
+{
+	if (pending.empty() || (long)(now - pending.front().release) < 0)
+		return 0;
+	Chunk &ch = pending.front();
+	int n = (int)ch.data.size() < max ? (int)ch.data.size() : max;
+	memcpy(buf, ch.data.data(), n);
+	if (n == (int)ch.data.size())
+		pending.pop_front();
+	else
+		ch.data.erase(0, n);
+	return n;
+}
+
+bool FaultInjector::Idle()
+{
+	return pending.empty();
+}
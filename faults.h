@@ -0,0 +1,72 @@
+// faults.h	- Fault injection for a serial byte stream (line noise, drops, latency, fragmentation, DC_BUSY)
+
+#ifndef FAULTS_H_INCLUDED
+#define FAULTS_H_INCLUDED
+
+#include <deque>
+#include <string>
+
+struct FaultConfig
+{
+	double noise;		// % of bytes with a bit flipped
+	double drop;		// % of bytes dropped
+	int delay;			// ms added to every chunk
+	int jitter;			// ms, random 0..jitter added on top of delay
+	int ackdelay;		// ms extra for chunks starting with the DC_COMMAND_ACK of a command
+	int frag;			// Split chunks into random pieces of at most this many bytes (0 = off)
+	double busy;		// % of command ACKs followed by a burst of DC_BUSY bytes
+	int busylen;		// Burst length
+	unsigned int seed;
+};
+
+struct FaultStats
+{
+	long bytes;			// Passed in
+	long corrupted;
+	long dropped;
+	long fragments;		// Extra pieces created by fragmentation
+	long busy;			// Bursts injected
+	long delayms;		// Total delay added
+};
+
+void faults_init(FaultConfig *cfg);
+
+// Parse a command line word eg noise=0.1 drop=0.01 delay=20 jitter=10 ackdelay=100 frag=16 busy=5
+// busylen=3 seed=42. Returns 1 if it was a fault option, 0 if not, -1 if the value is bad
+int faults_option(FaultConfig *cfg, const char *arg);
+
+void faults_describe(const FaultConfig *cfg, char *buf, int len);
+
+// One direction of a link. Data goes in with the time it arrived and comes out once its release
+// time has passed. The caller supplies the time so this works in real or simulated time.
+
+class FaultInjector
+{
+	private:
+		struct Chunk
+		{
+			unsigned long release;
+			std::string data;
+		};
+		std::deque<Chunk> pending;
+		FaultConfig cfg;
+		unsigned int rnd;
+		unsigned long lastRelease;
+		bool expectReply;			// Next byte Put() answers a command
+		unsigned int Random();
+		bool Chance(double percent);
+	public:
+		FaultStats stats;
+
+		FaultInjector(const FaultConfig *config);
+		void Put(const char *data, int len, unsigned long now);
+		// The host has just sent a command, so the next byte is the camera's reply. Only that byte
+		// gets the ACK faults, an 0xD1 inside packet data or a checksum is just data
+		void Command();
+		// Copy out up to max bytes of the next released chunk, returns 0 if nothing is due
+		int Get(char *buf, int max, unsigned long now);
+		bool Idle();
+		void ResetStats();
+};
+
+#endif // FAULTS_H_INCLUDED
@@ -0,0 +1,102 @@
+// filter.cpp	- Select pictures to download from their PICTURE_INFO metadata
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "filter.h"
+
+void filter_init(PicFilter *f)
+{
+	f->after = 0;
+	f->before = 0;
+	f->resolution = FILTER_ANY;
+	f->compression = FILTER_ANY;
+	f->last = 0;
+}
+
+static long parse_time(const char *s)
+{
+	// Relative to now eg -30m -2h -7d, else local YYYY-MM-DD[THH:MM[:SS]]. Returns 0 if invalid
+	if (*s == '-')
+	{
+		char unit = 0;
+		int n = 0;
+		if (sscanf(s+1, "%d%c", &n, &unit) != 2 || n < 0)
+			return 0;
+		long mult = unit == 'm' ? 60 : unit == 'h' ? 3600 : unit == 'd' ? 86400 : 0;
+		return mult ? (long)time(NULL) - n * mult : 0;
+	}
+
+	struct tm tm;
+	memset(&tm, 0, sizeof(tm));
+	int fields = sscanf(s, "%d-%d-%d%*c%d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+						&tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+	if (fields != 3 && fields != 5 && fields != 6)
+		return 0;
+	tm.tm_year -= 1900;
+	tm.tm_mon -= 1;
+	tm.tm_isdst = -1;
+	time_t t = mktime(&tm);
+	return t == (time_t)-1 ? 0 : (long)t;
+}
+
+int filter_option(PicFilter *f, const char *arg)
+{
+	const char *val = strchr(arg, '=');
+	if (val)
+		val++;
+
+	if (!_stricmp(arg, "today"))
+	{
+		time_t now = time(NULL);
+		struct tm *tm = localtime(&now);
+		tm->tm_hour = tm->tm_min = tm->tm_sec = 0;
+		f->after = (long)mktime(tm);
+		return 1;
+	}
+	else if (!_strnicmp(arg, "after=", 6))
+		return (f->after = parse_time(val)) ? 1 : -1;
+	else if (!_strnicmp(arg, "before=", 7))
+		return (f->before = parse_time(val)) ? 1 : -1;
+	else if (!_strnicmp(arg, "res=", 4))
+	{
+		if (!_stricmp(val, "lo") || !strcmp(val, "0"))
+			f->resolution = 0;
+		else if (!_stricmp(val, "hi") || !strcmp(val, "1"))
+			f->resolution = 1;
+		else
+			return -1;
+		return 1;
+	}
+	else if (!_strnicmp(arg, "comp=", 5))
+		return (f->compression = atoi(val)) > 0 ? 1 : -1;
+	else if (!_strnicmp(arg, "last=", 5))
+		return (f->last = atoi(val)) > 0 ? 1 : -1;
+	return 0;
+}
+
+bool filter_active(const PicFilter *f)
+{
+	return f->after || f->before || f->resolution != FILTER_ANY || f->compression != FILTER_ANY || f->last;
+}
+
+int filter_first(const PicFilter *f, int numPictures)
+{
+	if (f->last && numPictures > f->last)
+		return numPictures - f->last;
+	return 0;
+}
+
+bool filter_match(const PicFilter *f, int resolution, int compression, long taken)
+{
+	if (f->after && taken < f->after)
+		return false;
+	if (f->before && taken >= f->before)
+		return false;
+	if (f->resolution != FILTER_ANY && resolution != f->resolution)
+		return false;
+	if (f->compression != FILTER_ANY && compression != f->compression)
+		return false;
+	return true;
+}
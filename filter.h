@@ -0,0 +1,30 @@
+// filter.h	- Select pictures to download from their PICTURE_INFO metadata
+
+#ifndef FILTER_H_INCLUDED
+#define FILTER_H_INCLUDED
+
+#define FILTER_ANY -1
+
+struct PicFilter
+{
+	long after;			// Unix time, 0 for no limit
+	long before;
+	int resolution;		// pi_resolution (0 = 640x480, 1 = 1152x864) or FILTER_ANY
+	int compression;	// pi_compression or FILTER_ANY
+	int last;			// Only the newest N pictures, 0 for all
+};
+
+void filter_init(PicFilter *f);
+
+// Parse a command line word such as after=2014-06-01, before=2014-06-01T12:30, after=-2h, today,
+// res=hi, comp=1, last=10. Returns 1 if it was a filter option, 0 if not, -1 if the value is bad
+int filter_option(PicFilter *f, const char *arg);
+
+bool filter_active(const PicFilter *f);
+
+// First picture index to consider given the number in the camera (applies last=N)
+int filter_first(const PicFilter *f, int numPictures);
+
+bool filter_match(const PicFilter *f, int resolution, int compression, long taken);
+
+#endif // FILTER_H_INCLUDED
@@ -0,0 +1,131 @@
+// index.cpp	- Append-only index of every picture downloaded (see dcindex.cpp for queries)
+
+// Record layout, little-endian
+//   0 session   4 downloaded   8 taken   12 size (32 bits each)
+//  16 picnum   18 totalTaken (16 bits each)
+//  20 resolution   21 compression   22 sinkType   23 unused (8 bits each)
+//  24 camera[30]   54 fileName[12]   66 archive[62] (not terminated if full)
+// The header record is "DC210IDX", version (32 bits), record size (32 bits), then zeros
+
+#include <stdio.h>
+#include <string.h>
+#include "index.h"
+
+#define INDEX_MAGIC		"DC210IDX"
+#define INDEX_VERSION	1
+
+static void put16(unsigned char *p, unsigned long v)
+{
+	p[0] = (unsigned char)(v & 0xFF);
+	p[1] = (unsigned char)((v >> 8) & 0xFF);
+}
+
+static void put32(unsigned char *p, unsigned long v)
+{
+	put16(p, v & 0xFFFF);
+	put16(p+2, (v >> 16) & 0xFFFF);
+}
+
+static unsigned long get16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static unsigned long get32(const unsigned char *p)
+{
+	return get16(p) | (get16(p+2) << 16);
+}
+
+static void put_str(unsigned char *p, const char *s, int len)
+{
+	memset(p, 0, len);
+	int n = strlen(s);
+	if (n > len)
+	{
+		// Keep the tail, it is the part that tells paths apart
+		memcpy(p, "...", 3);
+		memcpy(p+3, s + n - (len - 3), len - 3);
+	}
+	else
+		memcpy(p, s, n);
+}
+
+static void get_str(char *s, const unsigned char *p, int len)
+{
+	memcpy(s, p, len);
+	s[len] = 0;
+	for (int i=len-1; i>=0 && (s[i] == ' ' || !s[i]); i--)
+		s[i] = 0;		// cameraIdent is space padded
+}
+
+bool index_append(const char *path, const IndexEntry *e)
+{
+	FILE *f = fopen(path, "ab");
+	if (!f)
+		return false;
+
+	unsigned char rec[INDEX_RECORD];
+	bool ok = true;
+	fseek(f, 0, SEEK_END);
+	if (ftell(f) == 0)
+	{
+		memset(rec, 0, sizeof(rec));
+		memcpy(rec, INDEX_MAGIC, 8);
+		put32(rec+8, INDEX_VERSION);
+		put32(rec+12, INDEX_RECORD);
+		ok = fwrite(rec, 1, sizeof(rec), f) == sizeof(rec);
+	}
+
+	memset(rec, 0, sizeof(rec));
+	put32(rec, e->session);
+	put32(rec+4, e->downloaded);
+	put32(rec+8, e->taken);
+	put32(rec+12, e->size);
+	put16(rec+16, e->picnum);
+	put16(rec+18, e->totalTaken);
+	rec[20] = (unsigned char)e->resolution;
+	rec[21] = (unsigned char)e->compression;
+	rec[22] = (unsigned char)e->sinkType;
+	put_str(rec+24, e->camera, 30);
+	put_str(rec+54, e->fileName, 12);
+	put_str(rec+66, e->archive, 62);
+	ok = ok && fwrite(rec, 1, sizeof(rec), f) == sizeof(rec);
+	return fclose(f) == 0 && ok;
+}
+
+FILE *index_open(const char *path, long *count)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return NULL;
+	unsigned char hdr[INDEX_RECORD];
+	if (fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr) || memcmp(hdr, INDEX_MAGIC, 8) ||
+		get32(hdr+8) != INDEX_VERSION || get32(hdr+12) != INDEX_RECORD)
+	{
+		fclose(f);
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	*count = ftell(f) / INDEX_RECORD - 1;		// A partly written last record is ignored
+	return f;
+}
+
+bool index_read(FILE *f, long recno, IndexEntry *e)
+{
+	unsigned char rec[INDEX_RECORD];
+	if (fseek(f, (recno + 1) * INDEX_RECORD, SEEK_SET) || fread(rec, 1, sizeof(rec), f) != sizeof(rec))
+		return false;
+	e->session = get32(rec);
+	e->downloaded = get32(rec+4);
+	e->taken = get32(rec+8);
+	e->size = get32(rec+12);
+	e->picnum = get16(rec+16);
+	e->totalTaken = get16(rec+18);
+	e->resolution = rec[20];
+	e->compression = rec[21];
+	e->sinkType = rec[22];
+	get_str(e->camera, rec+24, 30);
+	get_str(e->fileName, rec+54, 12);
+	get_str(e->archive, rec+66, 62);
+	return true;
+}
@@ -0,0 +1,38 @@
+// index.h	- Append-only index of every picture downloaded (see dcindex.cpp for queries)
+
+#ifndef INDEX_H_INCLUDED
+#define INDEX_H_INCLUDED
+
+#include <stdio.h>
+
+#define INDEX_DEFAULT	"dc210.idx"
+#define INDEX_RECORD	128		// Bytes, fixed so record n is at (n+1)*INDEX_RECORD (0 is a header)
+
+// One record per picture written to a sink, from STATUS and PICTURE_INFO. Records are only ever
+// appended, a file is never rewritten. Stored little-endian whatever the host.
+
+struct IndexEntry
+{
+	unsigned long session;		// Unix time the session started (with camera identifies the session)
+	unsigned long downloaded;	// Unix time
+	unsigned long taken;		// Unix time, from pi_elapsedTime
+	unsigned long size;			// pi_fileSize
+	int picnum;					// Index in the camera at the time
+	int totalTaken;				// Camera's totalPicturesTaken in that session
+	int resolution;				// pi_resolution
+	int compression;			// pi_compression
+	int sinkType;				// SINK_
+	char camera[31];			// cameraIdent
+	char fileName[13];			// pi_fileName, also the name in the archive or directory
+	char archive[63];			// Full path of the tar/zip or directory, "-" for stdout. Longer
+								// paths keep their tail, starting "..."
+};
+
+// Opens, appends and closes so nothing is lost if the session dies later. Returns false on failure
+bool index_append(const char *path, const IndexEntry *e);
+
+// Open for reading, *count is set to the number of records. NULL if missing or not an index
+FILE *index_open(const char *path, long *count);
+bool index_read(FILE *f, long recno, IndexEntry *e);
+
+#endif // INDEX_H_INCLUDED
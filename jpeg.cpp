@@ -0,0 +1,63 @@
+// jpeg.cpp	- Structural check of a downloaded JPEG (the markers, not the image)
+
+// Catches what a bad transfer leaves behind: a file cut short (no EOI), padding or junk after
+// EOI, and corruption that lands in the headers (a segment length running off the end or into
+// something that is not a marker). Damage inside the entropy coded data is not detectable this way.
+
+#include <stddef.h>
+#include "jpeg.h"
+
+#define M_SOI	0xD8
+#define M_EOI	0xD9
+#define M_SOS	0xDA
+#define M_TEM	0x01
+#define M_RST0	0xD0
+#define M_RST7	0xD7
+
+const char *jpeg_check(const unsigned char *p, long size)
+{
+	if (size < 4 || p[0] != 0xFF || p[1] != M_SOI)
+		return "no SOI marker";
+	if (p[size-2] != 0xFF || p[size-1] != M_EOI)
+		return "no EOI marker at the end";
+
+	long i = 2;
+	while (1)
+	{
+		if (i + 2 > size)
+			return "headers run past the end";
+		if (p[i] != 0xFF)
+			return "bad marker";
+		int m = p[i+1];
+		if (m == 0xFF)
+		{
+			i++;		// Fill byte before a marker
+			continue;
+		}
+		if (m == M_EOI)
+			return i + 2 == size ? NULL : "EOI before the end";
+		if (m == M_TEM)
+		{
+			i += 2;
+			continue;
+		}
+		if (m == M_SOI || (m >= M_RST0 && m <= M_RST7) || m == 0x00)
+			return "unexpected marker";
+
+		if (i + 4 > size)
+			return "headers run past the end";
+		long len = (p[i+2] << 8) | p[i+3];
+		if (len < 2 || i + 2 + len > size)
+			return "segment length runs past the end";
+		i += 2 + len;
+
+		if (m == M_SOS)
+		{
+			// Entropy coded data runs to the next marker, FF00 is a stuffed FF and RSTn are inside it
+			while (i + 1 < size && !(p[i] == 0xFF && p[i+1] != 0x00 && (p[i+1] < M_RST0 || p[i+1] > M_RST7)))
+				i++;
+			if (i + 1 >= size)
+				return "no EOI marker at the end";
+		}
+	}
+}
@@ -0,0 +1,10 @@
+// jpeg.h	- Structural check of a downloaded JPEG (the markers, not the image)
+
+#ifndef JPEG_H_INCLUDED
+#define JPEG_H_INCLUDED
+
+// Returns NULL if data holds together as a JPEG: SOI, marker segments whose lengths stay inside
+// the data, entropy coded data after each SOS, and EOI as the last two bytes. Else what is wrong
+const char *jpeg_check(const unsigned char *data, long size);
+
+#endif // JPEG_H_INCLUDED
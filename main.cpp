@@ -1,5 +1,5 @@
 // main.cpp	- Kodak DC210 camera
-// See kdcpi-0.0.3 for comms protocol
+// See kdcpi-0.0.3 for comms protocol (protocol is in dc210.cpp)
 
 // Based on example from http://playground.arduino.cc/Interfacing/CPPWindows
 
@@ -9,60 +9,36 @@
 
 #include <stdio.h>
 #include <ctype.h>
+#include <time.h>
 #include <tchar.h>
-#include "SerialClass.h"
+#include <conio.h>
+#include "dc210.h"
+#include "clock.h"
+#include "sink.h"
+#include "filter.h"
+#include "sim.h"
+#include "index.h"
+#include "sched.h"
+#include "thumb.h"
+#include "pool.h"
+#include "jpeg.h"
 #include <string>
+#include <algorithm>
+#include <vector>
 
 // CONFIGURATION
 
-#define VERBOSITY 0		// 0, 1, 2 (for debugging)
 #define LOGGING 0		// 0, 1 (for debugging)
 
-#define PICFILE_DBG "picdebug.jpg"	// More debugging
-#define PICFILE_DUMP "picdump.jpg"
 #define PICFILE_DEFAULT "picture.jpg"
-
-// From kdcpi-0.0.3
-// Control bytes
-#define PKT_CTRL_RECV    0x01
-#define PKT_CTRL_SEND    0x00
-#define PKT_CTRL_EOF     0x80
-#define PKT_CTRL_CANCEL  0xFF
-
-// Kodak System Codes
-#define DC_COMMAND_COMPLETE  0x00
-#define DC_COMMAND_ACK       0xD1
-#define DC_CORRECT_PACKET    0xD2
-#define DC_COMMAND_NAK       0xE1
-#define DC_ILLEGAL_PACKET    0xE3
-#define DC_BUSY              0xF0
-
-// Commands common to all implemented Kodak cameras
-#define DC_SET_SPEED         0x41
-
-// DC210
-#define DC210_LOW_RES_THUMBNAIL 0
-#define DC210_HIGH_RES_THUMBNAIL 1
-#define DC210_EPOC 852094800
-
-// Kodak System Commands
-#define DC210_SET_RESOLUTION      0x36
-#define DC210_PICTURE_DOWNLOAD    0x64
-#define DC210_PICTURE_INFO        0x65
-#define DC210_PICTURE_THUMBNAIL   0x66
-#define DC210_SET_SOMETHING       0x75
-#define DC210_TAKE_PICTURE        0x7C
-#define DC210_ERASE               0x7A
-#define DC210_ERASE_IMAGE_IN_CARD 0x7B
-#define DC210_INITIALIZE          0x7E
-#define DC210_STATUS              0x7F
-#define DC210_SET_CAMERA_ID       0x9E
+#define MAX_RECOVER     3			// Consecutive session recoveries before giving up
+#define WATCH_POLL_MIN  1000		// ms between STATUS polls in watch, stretching to
+#define WATCH_POLL_MAX  10000		// this while nothing changes
+#define SIM_LOG_DEFAULT "sim.csv"
+#define POWER_CHECK_MS  60000		// Most ms between STATUS reads during downloads on AC (on battery, every picture)
 
 // Make these global
-int checksum = 0;
-char incomingData[8192];		// Ensure its big enough for 1K download block
-char outData[256];
-char fullData[4*1024*1024];		// Used for status, picture info, picture transfer
+char fullData[4*1024*1024];		// Used for status, picture info and the picture being downloaded
 								// TODO allocate memory instead (4MB should suffice for DC210 though)
 
 // Status ... unpack('a1 C9 a2 N1 C1 a1 C7 n2 a28 C1 a32 a30',$data)
@@ -111,6 +87,11 @@ int pi_elapsedTime;
 char pi_undef2[17];			// a16
 char pi_fileName[13];		// a12
 
+Sink *sink = NULL;		// Where downloaded pictures go, see open_sink()
+int sinkKind;			// SINK_ and full path of the archive or directory, for the index
+char sinkWhere[MAX_PATH];
+FILE *msgout = stdout;	// Messages go to stderr if pictures are being written to stdout
+
 
 // End globals
 
@@ -155,7 +136,7 @@ int myprintf(char *fmt, ...)
 			}
 		}
 	}
-	printf(buf);
+	fputs(buf, msgout);
 	LOGGING && fprintf(logfile,buf);
 	fflush(logfile);
 	
@@ -174,7 +155,7 @@ void rev_short_as_int(int *n)	// Reverse network order of short value stored as
 	*n = t;
 }
 
-void unpack_status()
+void unpack_status(int quiet)
 {
 	// Just do a few for now
 	undef1 = fullData[0];
@@ -191,18 +172,20 @@ void unpack_status()
 	memset(undef5, 0, 29);
 	memcpy(&undef5, fullData+29, 28);
 	memcpy(&numPictures, fullData+57, 4);		// single byte value
+	memset(cameraIdent, 0, 31);
+	memcpy(cameraIdent, fullData+90, 30);
 	
 	// (VERBOSITY > 0) && myprintf("undef1=%d cameraTypeId=%d firmwareMajor=%d firmwareMinor=%d\n", undef1, cameraTypeId, firmwareMajor, firmwareMinor);
 
 	revint(&cameratime);
-	(VERBOSITY > -1) && myprintf("batteryStatusId=%d acStatusId=%d time=%d\n", batteryStatusId, acStatusId, cameratime);
+	(VERBOSITY > -1) && !quiet && myprintf("batteryStatusId=%d acStatusId=%d time=%d\n", batteryStatusId, acStatusId, cameratime);
 
 	// (VERBOSITY > 0) && myprintf("totalPicturesTaken=%08x totalFlashesFired=%08x numPictures=%08x\n", totalPicturesTaken, totalFlashesFired, numPictures);
 	
 	rev_short_as_int(&totalPicturesTaken);
 	rev_short_as_int(&totalFlashesFired);
 	// (VERBOSITY > 0) && myprintf("totalPicturesTaken=%08x totalFlashesFired=%08x numPictures=%08x\n", totalPicturesTaken, totalFlashesFired, numPictures);
-	(VERBOSITY > -1) && myprintf("totalPicturesTaken=%d totalFlashesFired=%d numPictures=%d\n", totalPicturesTaken, totalFlashesFired, numPictures);
+	(VERBOSITY > -1) && !quiet && myprintf("totalPicturesTaken=%d totalFlashesFired=%d numPictures=%d\n", totalPicturesTaken, totalFlashesFired, numPictures);
 }
 
 void unpack_picinfo()
@@ -218,602 +201,1437 @@ void unpack_picinfo()
 
 	rev_short_as_int(&pi_pictureNumber);
 	revint(&pi_fileSize);
+	revint(&pi_elapsedTime);
 	(VERBOSITY > -1) && myprintf("picnum=%d resolution=%d compression=%d fileName=%s fileSize=%d\n",
 		pi_pictureNumber, pi_resolution, pi_compression, pi_fileName, pi_fileSize);
 }
 
-void send_command(Serial* SP, int cmd, int arg1, int arg2, int arg3, int arg4)
+long pic_time()
 {
-	// All commands are 8 bytes
-	// my $data = pack("C8",$command,0x00,$arg1,$arg2,$arg3,$arg4,0x00,0x1A);
-	sprintf(outData,"%c%c%c%c%c%c%c%c",cmd,0x00,arg1,arg2,arg3,arg4,0x00,0x1A);
-	(VERBOSITY > 1) && myprintf("send_command %02X [%s]\n", cmd, outData);
-	SP->WriteData(outData,8);	// NB do NOT use strlen to get length due to nulls
+	// Unix time the current picture (from PICTURE_INFO) was taken
+	return DC210_EPOC + pi_elapsedTime / DC210_TICKS_PER_SEC;
 }
 
-void update_checksum(char *data, int len)
+// Session state
+int portSpeed = CBR_9600;
+int targetSpeed = CBR_115200;	// baud=N
+int no_setbaud = 0;
+int recoveries = 0;		// Consecutive, reset by each picture, STATUS or PICTURE_INFO that gets through
+int numDownloaded = 0;
+long bytesDownloaded = 0;
+
+// Simulated camera (port SIM), everything runs in virtual time
+SimSerial *sim = NULL;
+SimConfig simcfg;
+const char *simlog = NULL;
+
+void sim_report(int result, long pictureBytes)
 {
-	while (len--)
-		checksum ^= *data++;
+	// Where the virtual time went, optionally appended to a csv for benchmarking
+	if (!sim)
+		return;
+	FaultStats fs;
+	sim->FaultTotals(&fs);
+	DWORD elapsed = dc_ticks();
+	char desc[256];
+	faults_describe(&simcfg.faults, desc, sizeof(desc));
+
+	(VERBOSITY > -1) && myprintf("Simulated %lu ms at %d baud: line %.0f ms, camera %.0f ms, host %.0f ms\n",
+		elapsed, targetSpeed, sim->times.link, sim->times.camera, sim->times.host);
+	(VERBOSITY > -1) && myprintf("Simulated %ld commands, %ld bytes up, %ld down, %ld garbled, %ld corrupted, %ld dropped, %ld busy\n",
+		sim->commands, sim->bytesUp, sim->bytesDown, sim->garbled, fs.corrupted, fs.dropped, fs.busy);
+
+	if (!simlog)
+		return;
+	FILE *log = fopen(simlog, "a");
+	if (!log)
+	{
+		(VERBOSITY > -1) && myprintf("ERROR opening %s\n", simlog);
+		return;
+	}
+	fseek(log, 0, SEEK_END);
+	if (ftell(log) == 0)
+		fprintf(log, "baud,config,both,pictures,result,duration_ms,line_ms,camera_ms,host_ms,commands,up_bytes,down_bytes,picture_bytes,garbled,corrupted,dropped,fragments,busy\n");
+	fprintf(log, "%d,\"%s\",%d,%d,%d,%lu,%.0f,%.0f,%.0f,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld\n",
+		targetSpeed, desc, simcfg.both, simcfg.pictures, result, elapsed, sim->times.link, sim->times.camera,
+		sim->times.host, sim->commands, sim->bytesUp, sim->bytesDown, pictureBytes, sim->garbled,
+		fs.corrupted, fs.dropped, fs.fragments, fs.busy);
+	fclose(log);
 }
 
-void usage()
+// Index of everything downloaded (index.h), queried with dcindex
+const char *indexFile = INDEX_DEFAULT;
+int indexGiven = 0;		// index= or noindex on the command line
+unsigned long sessionStart;		// Unix time, identifies the session in the index
+
+void index_picture(int picnum)
 {
-	myprintf("Usage: serial COM4 status|list|get picnum|get all|get start end [nobaud]\n");
-	myprintf("If rerunning and camera does not sync, try \"nobaud\" flag\nIf it still fails power-cycle camera.\n");
-	exit(1);
+	// Record the picture just written from the current PICTURE_INFO and STATUS. A failure here
+	// doesn't fail the download
+	if (!indexFile)
+		return;
+	IndexEntry e;
+	memset(&e, 0, sizeof(e));
+	e.session = sessionStart;
+	e.downloaded = (unsigned long)time(NULL);
+	e.taken = pic_time();
+	e.size = pi_fileSize;
+	e.picnum = picnum;
+	e.totalTaken = totalPicturesTaken;
+	e.resolution = pi_resolution;
+	e.compression = pi_compression;
+	e.sinkType = sinkKind;
+	strncpy(e.camera, cameraIdent, sizeof(e.camera)-1);
+	strncpy(e.fileName, pi_fileName, sizeof(e.fileName)-1);
+	strncpy(e.archive, sinkWhere, sizeof(e.archive)-1);
+	if (!index_append(indexFile, &e))
+		(VERBOSITY > -1) && myprintf("WARNING could not add %s to index %s\n", pi_fileName, indexFile);
 }
 
-int _tmain(int argc, _TCHAR* argv[])
+int session_start(Serial* SP)
 {
-	// Process arguments, ought really to use getopt here (nobaud is an outlier, ought to be a switch)
-	
-	if (argc < 3 || argc > 6)
-		usage();
+	int err;
+	if (!no_setbaud)
+	{
+		(VERBOSITY > -1) && myprintf("Setting speed %d baud\n", targetSpeed);
+		// NB DC210 always starts at 9600 baud
+		if (targetSpeed != CBR_9600 && (err = dc_set_speed(SP, targetSpeed, &portSpeed)) != DC_OK)
+			return err;
+		no_setbaud = 1;		// Camera is at speed now
+	}
 
-	if (strlen(argv[1]) < 3 || strlen(argv[1]) > 5)
+	// Initialise camera
+	(VERBOSITY > -1) && myprintf("Initializing camera\n");
+	return dc_command(SP, DC210_INITIALIZE, 0, 0, NULL, 0, NULL, NULL);
+}
+
+void recover_or_exit(Serial* SP, int err)
+{
+	// A command failed, bring the camera back to 9600 and start the session again so the caller
+	// can retry the command. Gives up after MAX_RECOVER attempts without a picture completing
+	(VERBOSITY > -1) && myprintf("ERROR %s\n", dc_error(err));
+	while (++recoveries <= MAX_RECOVER)
 	{
-		myprintf("Port name too %s, 3-5 chars only\n", strlen(argv[1]) < 3 ? "short" : "long");
-		usage();
+		if (dc_recover(SP, &portSpeed))
+		{
+			no_setbaud = 0;
+			if (session_start(SP) == DC_OK)
+				return;
+		}
 	}
-	
-	char comport[20];
-	sprintf(comport,"\\\\.\\%s", argv[1]);
-	comport[4] = toupper(comport[4]);
-	comport[5] = toupper(comport[5]);
-	comport[6] = toupper(comport[6]);
+	(VERBOSITY > -1) && myprintf("ERROR camera not responding, giving up\n");
+	if (sink && !sink->Close())		// Keep the pictures already in an archive
+		(VERBOSITY > -1) && myprintf("ERROR closing archive\n");
+	(VERBOSITY > -1) && myprintf("Resetting speed to 9600 baud\n");
+	send_command(SP, DC_SET_SPEED, 0x96, 0, 0, 0);	// In case it is only the line that failed
+	dc_sleep(200);
+	sim_report(1, 0);
+	exit(1);
+}
 
-	if (strncmp(comport+4,"COM",3))
+DWORD statusTick;			// When STATUS was last read
+
+int get_status(Serial* SP, int quiet = 0)
+{
+	// Returns 256 byte packet vis ACK, PKT_CTRL_RECV, 256 bytes packet, CHECKSUM. quiet for polling
+	(VERBOSITY > -1) && !quiet && myprintf("Getting status\n");
+	int err = dc_command(SP, DC210_STATUS, 0, 0, fullData, 256, NULL, NULL);
+	if (err == DC_OK)
 	{
-		myprintf("Port name invalid, must be COM\n");
-		usage();
+		unpack_status(quiet);
+		statusTick = dc_ticks();
+		recoveries = 0;		// Only consecutive failures count, watch may poll for hours
 	}
+	return err;
+}
 
-	int wantPicNum = 0;
-	int wantLastPicNum = 0;
-	int	cmd_status = 0;
-	int	cmd_list = 0;
-	int	cmd_get = 0;		// Only used in command line check, valus is inferred in state machine
-							// due to non-prescence of cmd_status or cmd_list
-	int	cmd_all = 0;
-	int cmd_range = 0;
-	int	no_setbaud = 0;
-	
-	if (!_stricmp(argv[2],"status"))
-		cmd_status = 1;
-	else if (!_stricmp(argv[2],"list"))
-		cmd_list = 1;
-	else if (!_stricmp(argv[2],"get"))
-	{
-		cmd_get = 1;
-		if (argc < 4)
-			usage();
+// A camera that goes flat mid-transfer leaves the link in an unknown state, so the battery is
+// watched between transfers (STATUS is the only way to ask) and downloads stop at a picture
+// boundary once it is empty. The session then ends as usual, putting the camera back to 9600
+int powerState = DC210_BATTERY_OK;	// As last reported, OK whenever on AC
+int powerStop = 0;					// Battery empty, no more downloads this session
 
-		else if (!_stricmp(argv[3],"all"))
-		{
-			cmd_all = 1;
-		}
+int power_note()
+{
+	// Power state from the last STATUS, reporting any change
+	int state = acStatusId == DC210_AC_CONNECTED ? DC210_BATTERY_OK : batteryStatusId;
+	if (state != DC210_BATTERY_LOW && state != DC210_BATTERY_EMPTY)
+		state = DC210_BATTERY_OK;
+	if (state != powerState)
+	{
+		if (state == DC210_BATTERY_LOW)
+			(VERBOSITY > -1) && myprintf("Battery low\n");
+		else if (state == DC210_BATTERY_EMPTY)
+			(VERBOSITY > -1) && myprintf("Battery empty, no more downloads this session\n");
 		else
-		{
-			cmd_all = 1;		// Use same flag for range
-			cmd_range = 1;
-			char *pargvpic = argv[3];
-			while (*pargvpic)
-			if (!isdigit(*pargvpic++))
-			{
-				myprintf("Picnum \"%s\" is not a valid integer\n", argv[3]);
-				usage();
-			}
-			wantPicNum = atoi(argv[3]);
+			(VERBOSITY > -1) && myprintf("Power OK\n");
+		powerState = state;
+	}
+	if (state == DC210_BATTERY_EMPTY)
+		powerStop = 1;
+	return state;
+}
+
+int power_check(Serial* SP)
+{
+	// Between transfers, reads STATUS if it is due. On battery that is every time, a long picture at
+	// 9600 can take it from OK to empty and the low stage would be missed. Returns DC210_BATTERY_
+	int err;
+	if (acStatusId != DC210_AC_CONNECTED || dc_ticks() - statusTick >= (DWORD)POWER_CHECK_MS)
+		while ((err = get_status(SP, 1)) != DC_OK)
+			recover_or_exit(SP, err);
+	return power_note();
+}
+
+int get_picinfo(Serial* SP, int picnum)
+{
+	// Pictures are indexed from 0
+	(VERBOSITY > 0) && myprintf("Listing picture\n");
+	int err = dc_command(SP, DC210_PICTURE_INFO, picnum, 0, fullData, 256, NULL, NULL);
+	if (err == DC_OK)
+	{
+		unpack_picinfo();
+		recoveries = 0;
+	}
+	return err;
+}
+
+// Operator requests during a get: type a picture number and Enter to have it next, q to stop
+WorkQueue *queue = NULL;	// Of the get running
+WorkItem current;			// Being downloaded
+char requestLine[8];
+int requestLen = 0;
+int stopRequested = 0;
 
-			if (argc > 4 && _stricmp(argv[4],"nobaud"))
+void poll_requests()
+{
+	while (_kbhit())
+	{
+		int c = _getch();
+		if (c == 'q' || c == 'Q' || c == 27)
+			stopRequested = 1;
+		else if (isdigit(c) && requestLen < 5)
+			requestLine[requestLen++] = c;
+		else if ((c == '\r' || c == '\n') && requestLen)
+		{
+			requestLine[requestLen] = 0;
+			requestLen = 0;
+			int picnum = atoi(requestLine);
+			if (picnum >= numPictures)
+				(VERBOSITY > -1) && myprintf("\nNo picture %d, only %d in camera\n", picnum, numPictures);
+			else
 			{
-				char *pargvpic = argv[4];
-				while (*pargvpic)
-				if (!isdigit(*pargvpic++))
-				{
-					myprintf("Picnum \"%s\" is not a valid integer\n", argv[4]);
-					usage();
-				}
-				wantLastPicNum = atoi(argv[4]);
+				(VERBOSITY > -1) && myprintf("\nPicture %d requested\n", picnum);
+				queue->Add(WORK_PICTURE, picnum, PRI_URGENT);
 			}
 		}
 	}
-	else
+}
+
+bool download_block(void *ctx, const char *data, int len, int offset)
+{
+	// Blocks are collected in fullData by dc_command, the picture goes to the sink once complete so
+	// a transfer can be abandoned between any two blocks for something more urgent
+	(VERBOSITY > 0) && myprintf("bytesDownloaded %d pi_fileSize %d\n", offset + len, pi_fileSize);
+	if (VERBOSITY == 0) { myprintf("."); fflush(msgout); }	// Progress as line of dots
+	if (queue)
 	{
-		usage();
+		poll_requests();
+		if (stopRequested || queue->Preempts(&current))
+			return false;		// dc_command sends PKT_CTRL_CANCEL
 	}
+	return true;
+}
 
-	int numargs = argc;	// Used in checks below
-	if (!_stricmp(argv[argc-1],"nobaud"))
+int download_picture(Serial* SP, int picnum)
+{
+	// Returns 1024 byte packets vis ACK, PKT_CTRL_RECV, 1024 bytes packet, CHECKSUM
+	// NB packet is ALWAYS 1024 bytes, the last one is padded. Needs PICTURE_INFO first for the size.
+	// The picture is left in fullData, see store_picture()
+	int err = dc_command(SP, DC210_PICTURE_DOWNLOAD, picnum, 0, fullData, pi_fileSize, download_block, NULL);
+	(VERBOSITY == 0) && myprintf("\n");	// End line of dots
+	if (err != DC_OK)
+		return err;
+
+	(VERBOSITY > -1) && myprintf("Download done\n");
+	recoveries = 0;
+	return DC_OK;
+}
+
+void store_picture(int picnum)
+{
+	// The picture downloaded into fullData to the sink and the index
+	char *fname = pi_fileName;
+	if (strncmp(pi_fileName,"DCP",3))
 	{
-		no_setbaud = 1;
-		numargs--;
+		fname = PICFILE_DEFAULT;
+		(VERBOSITY > -1) && myprintf("Invalid filename %s, using %s instead\n",pi_fileName,fname);
 	}
+	if (!sink->Begin(fname, pi_fileSize, pic_time()) || !sink->Write(fullData, pi_fileSize) || !sink->End())
+	{
+		(VERBOSITY > -1) && myprintf("ERROR writing picture %s\n", pi_fileName);
+		exit(1);
+	}
+	(VERBOSITY > -1) && myprintf("%s written\n", pi_fileName);
+	index_picture(picnum);
+	numDownloaded++;
+	bytesDownloaded += pi_fileSize;
+}
 
-	// Be rather more strict about extra parameters
-	if ((cmd_status || cmd_list) && numargs > 3)
-		usage();
-	if (cmd_get)
+int transfer_picture(Serial* SP, int picnum)
+{
+	// Download into fullData, retrying through recoveries. PICTURE_INFO must have been read already.
+	// Returns DC_ERR_CANCELLED if abandoned for something more urgent
+	int err;
+	if (pi_fileSize <= 1024 || pi_fileSize > (int)sizeof(fullData) - 1024)	// Just check its more than a block (it will be)
 	{
-		if (cmd_all && !cmd_range && numargs > 4)
-			usage();
-		if (cmd_all && cmd_range && numargs > 5)
-			usage();
-		if (!cmd_all && numargs > 4)
-			usage();
+		(VERBOSITY > -1) && myprintf("ERROR pi_fileSize %d out of range\n", pi_fileSize);
+		return DC_ERR_PROTOCOL;
 	}
+	while ((err = download_picture(SP, picnum)) != DC_OK)
+	{
+		if (err == DC_ERR_CANCELLED)
+			return err;
+		recover_or_exit(SP, err);
+	}
+	return DC_OK;
+}
 
-	// DEBUG checking syntax
-#if 0
-	printf("p1=%d p2=%d status=%d list=%d get=%dall=%d range=%d nobaud=%d\n", wantPicNum,
-			wantLastPicNum,	cmd_status,	cmd_list, cmd_get, cmd_all, cmd_range, no_setbaud);
-	exit(1);
-#endif
-	
-	myprintf("Connecting to serial port %s\n", argv[1]);
+int fetch_picture(Serial* SP, int picnum)
+{
+	// Download and store, as transfer_picture()
+	int err = transfer_picture(SP, picnum);
+	if (err == DC_OK)
+		store_picture(picnum);
+	return err;
+}
 
-	// Baud rate is set to 9600 in serial.cpp to match DC210 initial rate
-	Serial* SP = new Serial(comport);
+int download_thumbnail(Serial* SP, int picnum)
+{
+	// THUMB_SIZE bytes of RGB into fullData, retrying through recoveries. Returns DC_ERR_CANCELLED
+	// if abandoned for something more urgent, DC_ERR_LENGTH if the camera sent some other size
+	// (PICTURE_INFO doesn't give it, THUMB_SIZE is the DC210's) for the caller to skip it
+	int err;
+	while ((err = dc_command(SP, DC210_PICTURE_THUMBNAIL, picnum, DC210_LOW_RES_THUMBNAIL,
+							 fullData, THUMB_SIZE, download_block, NULL)) != DC_OK)
+	{
+		(VERBOSITY == 0) && myprintf("\n");
+		if (err == DC_ERR_CANCELLED)
+			return err;
+		if (err == DC_ERR_LENGTH)
+		{
+			(VERBOSITY > -1) && myprintf("Thumbnail %d is not %dx%d RGB, skipped\n", picnum, THUMB_WIDTH, THUMB_HEIGHT);
+			recoveries = 0;		// The link is fine
+			return err;
+		}
+		recover_or_exit(SP, err);
+	}
+	(VERBOSITY == 0) && myprintf("\n");
+	recoveries = 0;
+	return DC_OK;
+}
 
-	if (SP->IsConnected())
+int fetch_thumbnail(Serial* SP, int picnum)
+{
+	// Thumbnail into the sink as a BMP named after the picture. PICTURE_INFO must have been read
+	int err = download_thumbnail(SP, picnum);
+	if (err != DC_OK)
+		return err;
+
+	static char bmp[THUMB_BMP_SIZE];
+	thumb_to_bmp(fullData, bmp);
+	char fname[20];
+	strcpy(fname, pi_fileName);
+	char *ext = strrchr(fname, '.');
+	strcpy(ext && ext - fname <= 8 ? ext : fname + strlen(fname), ".BMP");
+	if (!sink->Begin(fname, THUMB_BMP_SIZE, pic_time()) || !sink->Write(bmp, THUMB_BMP_SIZE) || !sink->End())
 	{
-		myprintf("We're connected\n");
+		(VERBOSITY > -1) && myprintf("ERROR writing thumbnail %s\n", fname);
+		exit(1);
 	}
-	else
+	(VERBOSITY > -1) && myprintf("%s written\n", fname);
+	return DC_OK;
+}
+
+void capture(Serial* SP, int interval, int count, int erase)
+{
+	// Take pictures on a timer (interval ms) or keypress and download each as it is taken. The
+	// interval runs from the previous shutter so the download overlaps the wait for the next frame
+	// (if it overran, the next frame is taken straight away)
+	int numFrames = 0;
+	int prevNumPictures = numPictures;
+	DWORD nextShot = dc_ticks();
+	int err;
+
+	if (!interval)
+		(VERBOSITY > -1) && myprintf("Press SPACE to take a picture, q to quit\n");
+
+	while (!count || numFrames < count)
 	{
-		myprintf("ERROR not connected\n");
-		return 1;
+		int trigger = interval && (int)(dc_ticks() - nextShot) >= 0;
+		if (_kbhit())
+		{
+			int c = _getch();
+			if (c == 'q' || c == 'Q' || c == 27)
+				break;
+			if (!interval && c == ' ')
+				trigger = 1;
+		}
+		if (!trigger)
+		{
+			dc_sleep(10);
+			continue;
+		}
+		if (power_check(SP) == DC210_BATTERY_EMPTY)
+			break;
+
+		numFrames++;
+		DWORD shotTick = dc_ticks();
+		nextShot = shotTick + interval;
+		(VERBOSITY > -1) && myprintf("Taking picture %d\n", numFrames);
+
+		// TAKE_PICTURE responds ACK, DC_BUSY while working, then DC_COMMAND_COMPLETE. If that fails
+		// don't take another, the status below shows whether the picture was stored
+		if ((err = dc_command(SP, DC210_TAKE_PICTURE, 0, 0, NULL, 0, NULL, NULL)) != DC_OK)
+			recover_or_exit(SP, err);
+
+		// Re-read status to find the new picture
+		while ((err = get_status(SP)) != DC_OK)
+			recover_or_exit(SP, err);
+		if (numPictures <= prevNumPictures)
+		{
+			(VERBOSITY > -1) && myprintf("WARNING no new picture in camera (card full?)\n");
+			continue;
+		}
+		prevNumPictures = numPictures;
+
+		int picnum = numPictures - 1;	// Newest picture
+		while ((err = get_picinfo(SP, picnum)) != DC_OK)
+			recover_or_exit(SP, err);
+		if (fetch_picture(SP, picnum) != DC_OK)
+			continue;
+		(VERBOSITY > -1) && myprintf("Frame %d shutter-to-disk %d ms\n", numFrames, dc_ticks() - shotTick);
+
+		if (erase)
+		{
+			// So the card never fills
+			(VERBOSITY > 0) && myprintf("Erasing picture %d\n", picnum);
+			while ((err = dc_command(SP, DC210_ERASE_IMAGE_IN_CARD, picnum, 0, NULL, 0, NULL, NULL)) != DC_OK)
+				recover_or_exit(SP, err);
+			numPictures--;
+			prevNumPictures = numPictures;
+		}
 	}
+}
+
+void watch(Serial* SP, int minPoll, int maxPoll, int count)
+{
+	// Poll STATUS and download each new picture as soon as it shows up. The poll interval starts at
+	// minPoll ms and stretches by half each time nothing has changed, up to maxPoll, then drops back
+	// on any change so a burst of shots is followed closely while an idle camera costs little
+	int prevNumPictures = numPictures;
+	int prevTaken = totalPicturesTaken;
+	int poll = minPoll;
+	DWORD nextPoll = dc_ticks() + poll;
+	int numNew = 0;
+	long totalDelay = 0;
+	int err;
+
+	(VERBOSITY > -1) && myprintf("Watching for new pictures, polling every %d-%d ms, q to stop\n", minPoll, maxPoll);
+	while (!count || numNew < count)
+	{
+		if (_kbhit())
+		{
+			int c = _getch();
+			if (c == 'q' || c == 'Q' || c == 27)
+				break;
+		}
+		if ((int)(dc_ticks() - nextPoll) < 0)
+		{
+			dc_sleep(10);
+			continue;
+		}
 
-	int dataLength = sizeof(incomingData)-1;	// Not sure it needs -1
-	int readResult = 0;
-	int bytesDownloaded = 0;
-	int seq = 0;		// State machine
-	int expectData = 0;	// Expected bytes to be read
-	int lastExpectData = 0;
-	int moreData = 0;	// For split packets
-	int wroteData = 0;	// per packet
+		while ((err = get_status(SP, 1)) != DC_OK)
+			recover_or_exit(SP, err);
+		if (power_note() == DC210_BATTERY_EMPTY)
+			break;		// Anything new stays on the card
+		DWORD seenTick = dc_ticks();
+		int seenTime = cameratime;
+
+		// New pictures are added at the end. If some were erased as well numPictures understates
+		// them, the shot counter doesn't
+		int fresh = numPictures - prevNumPictures;
+		if (totalPicturesTaken - prevTaken > fresh)
+			fresh = totalPicturesTaken - prevTaken;
+		if (fresh > numPictures)
+			fresh = numPictures;
+		if (numPictures != prevNumPictures || totalPicturesTaken != prevTaken)
+			poll = minPoll;
+		else if ((poll += poll / 2) > maxPoll)
+			poll = maxPoll;
+		prevNumPictures = numPictures;
+		prevTaken = totalPicturesTaken;
+
+		for (int picnum=numPictures-fresh; picnum<numPictures && (!count || numNew < count); picnum++)
+		{
+			if (picnum > numPictures-fresh && power_check(SP) == DC210_BATTERY_EMPTY)
+				break;		// The first was just checked
+			while ((err = get_picinfo(SP, picnum)) != DC_OK)
+				recover_or_exit(SP, err);
+			if (fetch_picture(SP, picnum) != DC_OK)
+				continue;
+			// Camera clock to when it was seen, then our clock to now
+			long delay = (seenTime - pi_elapsedTime) * 1000L / DC210_TICKS_PER_SEC + (long)(dc_ticks() - seenTick);
+			totalDelay += delay;
+			numNew++;
+			(VERBOSITY > -1) && myprintf("%s in %ld ms from the shutter\n", pi_fileName, delay);
+		}
+		nextPoll = dc_ticks() + poll;
+	}
+	numNew && (VERBOSITY > -1) && myprintf("%d new pictures, %ld ms from the shutter on average\n", numNew, totalDelay / numNew);
+}
 
-	int noACK = 0;		// Flag
-	int wait_PKT = 0;	// Sometimes we get an ACK and need to wait on PKT_CTRL_RECV
+// scan: which ports have a camera attached. Each port is probed on its own thread as it is nearly
+// all waiting (the 500ms settle in the Serial constructor and the camera's replies), so a sweep
+// takes about as long as the slowest port
 
-	FILE *dbgfile = NULL;
-	if (0)				// DEBUGGING dump file as we read it
+struct Probe
+{
+	char port[20];			// As given, eg COM3
+	int present;			// Port could be opened
+	int err;				// DC_ result of INITIALIZE then STATUS
+	char cameraIdent[31];
+	int numPictures;
+	int batteryStatusId;
+	int acStatusId;
+	DWORD ms;
+};
+
+void probe_port(void *arg)
+{
+	// Only INITIALIZE and STATUS at 9600, the speed is never raised so there is nothing to put back.
+	// The status is unpacked here (as unpack_status) as the globals belong to the main thread
+	Probe *p = (Probe*)arg;
+	DWORD start = dc_ticks();
+	Serial *SP;
+	if (!_stricmp(p->port, "SIM"))
+		SP = new SimSerial(&simcfg);
+	else
 	{
-		dbgfile = fopen(PICFILE_DBG,"wb");	// TODO use filename (check it too)
-		if (!dbgfile)
+		char comport[32];
+		sprintf(comport, "\\\\.\\%s", p->port);
+		SP = new Serial(comport);
+	}
+	p->present = SP->IsConnected();
+	if (p->present)
+	{
+		char status[256];
+		p->err = dc_command(SP, DC210_INITIALIZE, 0, 0, NULL, 0, NULL, NULL);
+		if (p->err == DC_OK)
+			p->err = dc_command(SP, DC210_STATUS, 0, 0, status, 256, NULL, NULL);
+		if (p->err == DC_OK)
 		{
-			myprintf("ERROR opening output file %s\n", PICFILE_DBG);
-			exit(1);
+			p->batteryStatusId = status[8];
+			p->acStatusId = status[9];
+			p->numPictures = (unsigned char)status[57];
+			memcpy(p->cameraIdent, status+90, 30);
+			p->cameraIdent[30] = 0;
 		}
 	}
-	
-	int dbgpos = 0;
+	delete SP;
+	p->ms = dc_ticks() - start;
+}
 
-	if (no_setbaud)
-		SP->SetSpeed(CBR_115200);	// Camera is already at speed, so set port baudrate
-	
-	while(SP->IsConnected())
+bool port_order(const std::string &a, const std::string &b)
+{
+	return atoi(a.c_str()+3) < atoi(b.c_str()+3);
+}
+
+int scan(int nports, char **names)
+{
+	// names are the ports to try, else every COM port the system has. Returns 0 if a camera was found
+	std::vector<std::string> ports;
+	for (int i=0; i<nports; i++)
+		ports.push_back(names[i]);
+	if (!nports)
+	{
+		// The DOS device names, the COM ones are the serial ports (USB adapters included)
+		std::vector<char> devices(65536);
+		if (QueryDosDevice(NULL, &devices[0], (DWORD)devices.size()))
+			for (char *d = &devices[0]; *d; d += strlen(d) + 1)
+				if (!_strnicmp(d, "COM", 3) && isdigit(d[3]) && strlen(d) <= 6)
+					ports.push_back(d);
+		std::sort(ports.begin(), ports.end(), port_order);
+	}
+	if (ports.empty())
+	{
+		myprintf("No serial ports found\n");
+		return 1;
+	}
+
+	std::vector<Probe> probes(ports.size());
+	for (size_t i=0; i<ports.size(); i++)
 	{
-		readResult = SP->ReadData(incomingData,dataLength);
+		memset(&probes[i], 0, sizeof(Probe));
+		strncpy(probes[i].port, ports[i].c_str(), sizeof(probes[i].port)-1);
+		_strupr(probes[i].port);
+	}
 
-		// NB If we get packet handling wrong the camera may hang & need battery's out to reset
+	myprintf("Scanning %d port%s at 9600 baud\n", (int)probes.size(), probes.size() == 1 ? "" : "s");
+	DWORD start = dc_ticks();
+	{
+		// One thread per port. The simulator runs in virtual time, which only one thread can drive
+		ThreadPool pool(clock_is_virtual() ? 1 : (int)probes.size());
+		for (size_t i=0; i<probes.size(); i++)
+			pool.Run(probe_port, &probes[i]);
+		pool.Wait();
+	}
+	DWORD elapsed = dc_ticks() - start;
 
-		if (readResult > 0)
+	static const char *battery[] = { "OK", "low", "empty" };
+	int found = 0;
+	myprintf("%-8s %-30s %8s %-7s %-3s %6s\n", "Port", "cameraIdent", "Pictures", "Battery", "AC", "ms");
+	for (size_t i=0; i<probes.size(); i++)
+	{
+		Probe *p = &probes[i];
+		if (!p->present)
+			myprintf("%-8s %-30s %8s %-7s %-3s %6lu\n", p->port, "(cannot open)", "", "", "", p->ms);
+		else if (p->err != DC_OK)
+			myprintf("%-8s %-30s %8s %-7s %-3s %6lu\n", p->port, "(no camera at 9600)", "", "", "", p->ms);
+		else
 		{
-			// Hex dump (camera response)
-			if (VERBOSITY > 1)
-			{
-				for (int i=0; i<readResult; i++)
-					(VERBOSITY > 1) && myprintf("%02X ", (unsigned char)(incomingData[i]));	// Need cast else prints FFFFFFE1 for E1
-				(VERBOSITY > 1) && myprintf("\n");
-			}
+			found++;
+			myprintf("%-8s %-30s %8d %-7s %-3s %6lu\n", p->port, p->cameraIdent, p->numPictures,
+				p->batteryStatusId >= 0 && p->batteryStatusId <= 2 ? battery[p->batteryStatusId] : "?",
+				p->acStatusId == 1 ? "yes" : "no", p->ms);
+		}
+	}
+	myprintf("%d camera%s found, %lu ms\n", found, found == 1 ? "" : "s", elapsed);
+	return found ? 0 : 1;
+}
 
-			int cam_status = (unsigned char)(incomingData[0]);		// Need cast
-			int cam_byte1 = (unsigned char)(incomingData[1]);		// Need cast
-			
-			if (!expectData)
-				(VERBOSITY > -1) && myprintf("ERROR - no data was expected\n");	// May want to abort
+// A job is one operation, from the command line or a line of a manifest (see "run")
 
-			(VERBOSITY > 1) && myprintf("seq=%d bytes=%d\n", seq,readResult);
+#define JOB_STATUS	0
+#define JOB_LIST	1
+#define JOB_GET		2
+#define JOB_CAPTURE	3
+#define JOB_WATCH	4
+#define JOB_SHEET	5
+#define JOB_VERIFY	6
 
-			// DC210 camera comms state machine (receive from camera) 
-			
-			if (seq == 1)
-			{
-				// Set speed just responds with one byte ACK
-				if (readResult!=expectData || cam_status!=DC_COMMAND_ACK)
-					{ (VERBOSITY > -1) && myprintf("... UNEXPECTED\n"); exit(1); }
-				else
-					{ (VERBOSITY > 0) && myprintf("... OK\n"); seq++; }
-
-				// SP->SetSpeed(CBR_19200);
-				SP->SetSpeed(CBR_115200);				
-				// CARE may need to power cycle camera if program aborts since still in high speed mode
-			}
-			else if (seq == 3)
-			{
-				// Other commands respond with ACK, then we have to keep reading if we get DC_BUSY (0xF0) until
-				// until DC_COMMAND_COMPLETE (0x00). Here we assume the latter (TODO COPE with busy or split packet)
-				if (readResult!=expectData || cam_status!=DC_COMMAND_ACK || cam_byte1!=DC_COMMAND_COMPLETE)
-					{ (VERBOSITY > -1) && myprintf("... UNEXPECTED\n"); exit(1); }
-				else
-					{ (VERBOSITY > 0) && myprintf("... OK\n"); seq++; }
-			}
-			else if (seq == 5 || seq == 9 || seq == 13)
-			{
-				(VERBOSITY > 1) && myprintf("expectData=%d readResult=%d moreData=%d noAck=%d wait_PKT=%d\n", expectData, readResult, moreData, noACK, wait_PKT);
-				// This is a large packet and may span several reads
-				// UGH, packet control. Expect ACK then PKT_CTRL_RECV (0x01) then 256 bytes then CHECKSUM
-				// Need to send back  a single byte DC_ILLEGAL_PACKET or DC_CORRECT_PACKET !!
-				// NB we include CHECKSUM in the memcpy as its simpler
-				if (moreData)
-				{
-					if (wait_PKT)
-					{
-						if (cam_status!=PKT_CTRL_RECV)
-							{ (VERBOSITY > -1) && myprintf("... UNEXPECTED\n"); exit(1); }
-						else
-							{ (VERBOSITY > 1) && myprintf("... wait_PKT OK\n"); }
-						wait_PKT = 0;
-						if (readResult > 1)
-						{
-							memcpy(fullData + bytesDownloaded + wroteData, incomingData+1, readResult-1);
-							update_checksum(incomingData+1, readResult-1);
-							wroteData += readResult-1;
-						}
-					}
-					else
-					{
-						memcpy(fullData + bytesDownloaded + wroteData, incomingData, readResult);
-						update_checksum(incomingData, readResult);
-						wroteData += readResult;
-					}
-					moreData -= readResult;
-					(VERBOSITY > 1) && myprintf("CONTINUED New value moreData=%d\n", moreData);
-					seq++;
-				}
-				else
-				{
-					wroteData = 0;
-					if (noACK)
-					{
-						if (readResult<2 || cam_status!=PKT_CTRL_RECV)
-							{ (VERBOSITY > -1) && myprintf("... UNEXPECTED\n"); exit(1); }
-						else
-							{ (VERBOSITY > 1) && myprintf("... OK\n"); seq++; }
-					}
-					else 
-					{
-						if (readResult==1)
-						{
-							// Sometimes we get an ACK and need to wait on PKT_CTRL_RECV
-							if (cam_status!=DC_COMMAND_ACK)
-								{ (VERBOSITY > -1) && myprintf("... UNEXPECTED\n"); exit(1); }
-							else
-								{ (VERBOSITY > 1) && myprintf("... BARE ACK, WAIT PKT_CTRL_RECV\n"); wait_PKT=1; seq++; }
-								// NB This will be handled in moreData above
-						}
-						else
-						{
-							if (readResult<3 || cam_status!=DC_COMMAND_ACK || cam_byte1!=PKT_CTRL_RECV)
-								{ (VERBOSITY > -1) && myprintf("... UNEXPECTED\n"); exit(1); }
-							else
-								{ (VERBOSITY > 1) && myprintf("... OK\n"); seq++; }
-						}
-					}
-					if ((readResult > 2) || (noACK && (readResult > 1)))
-					{
-						memcpy(fullData + bytesDownloaded + wroteData, incomingData +2-noACK, readResult-2+noACK);
-						update_checksum(incomingData +2-noACK, readResult-2+noACK);
-						wroteData += readResult-2+noACK;
-					}
-					moreData = expectData - readResult;
-					(VERBOSITY > 1) && myprintf("FIRST New value moreData=%d\n", moreData);
-				}
-				if (moreData)
-					seq--;	// Continue reading
-				if (moreData < 0)
-				{
-					(VERBOSITY > -1) && myprintf("... NEGATIVE moreData=%d (readResult=%d)\n", moreData, readResult);
-					// Dump the file here so we at least get something ...
-					moreData = 0;
-					(VERBOSITY > -1) && myprintf("DUMPING received data to file %s\n", PICFILE_DUMP);
-					FILE *ofile = fopen(PICFILE_DUMP,"wb");
-					if (!ofile)
-					{
-						(VERBOSITY > -1) && myprintf("ERROR opening output file s\n", PICFILE_DUMP);
-						exit(1);
-					}
-					fwrite(fullData, pi_fileSize, 1, ofile);
-					fclose(ofile);
-					(VERBOSITY > -1) && myprintf("%s file written\n", PICFILE_DUMP);
-				}
-				
-				// We send DC_CORRECT_PACKET in seq 6
-				if (!moreData)
-				{
-					if (checksum)		// Checksum should finish on 0
-					{
-						(VERBOSITY > -1) && myprintf("BAD CHECKSUM\n");
-						// TODO send DC_ILLEGAL_PACKET and re-read packet
-					}
-						
-					if (seq == 6) unpack_status();	// NB seq incremented above
-					if (seq == 10) unpack_picinfo();
-					// if (seq == 14) ;				// Handled in seq==14 below
-				}
-			}
-			else if (seq == 7 || seq == 11 || seq == 15)
-			{
-				// Responds with one byte DC_COMMAND_COMPLETE (0x00)
-				if (readResult!=expectData || cam_status!=DC_COMMAND_COMPLETE)
-					{ (VERBOSITY > -1) && myprintf("... UNEXPECTED\n"); exit(1); }
-				else
-					{ (VERBOSITY > 1) && myprintf("... OK\n"); seq++; }
-			}
+struct Job
+{
+	int cmd;				// JOB_
+	int first;				// get, sheet and verify range
+	int last;				// -1 for all
+	PicFilter filter;		// Which pictures get downloads
+	int sinkType;
+	char sinkPath[MAX_PATH];	// Empty for the current directory
+	int captureInterval;	// ms, 0 for keypress trigger
+	int captureCount;		// 0 for until q pressed (capture and watch)
+	int captureErase;
+	int order;				// ORDER_ for get
+	int thumbs;				// Thumbnails of all of them first
+	int pollMin;			// ms, watch
+	int pollMax;
+	int line;				// In manifest, 0 for command line
+};
+
+void usage()
+{
+	myprintf("Usage: serial COM4 status|list|get picnum|get all|get start end|capture|watch|sheet|verify [tar=FILE|zip=FILE|stdout|dir=DIR] [nobaud]\n");
+	myprintf("       serial COM4 run MANIFEST [nobaud]\n");
+	myprintf("       serial scan [COM1 COM2 ...] (find the cameras, all ports at once, default every COM port)\n");
+	myprintf("       serial SIM ... [pics=N] [shoot=SECONDS] [battery=SECONDS] [thumb=BYTES] [fault options] [both] [simlog=FILE] (simulated camera, virtual time)\n");
+	myprintf("tar=FILE or zip=FILE streams all pictures into one archive, FILE may be - for stdout\n");
+	myprintf("stdout writes the pictures to stdout (concatenated if more than one), dir=DIR writes them to DIR\n");
+	myprintf("get all or get start end may be followed by filters, only matching pictures are downloaded:\n");
+	myprintf("  after=T before=T (T is YYYY-MM-DD[THH:MM[:SS]] or -30m -2h -7d), today, res=hi|lo, comp=N, last=N\n");
+	myprintf("get also takes order=oldest|newest|smallest and thumbs (all thumbnails first, as BMP). While it runs type a\n");
+	myprintf("  picture number and Enter to fetch that one next (the current transfer is put aside), q stops\n");
+	myprintf("capture takes and downloads pictures: interval=SECONDS (else press space, q quits), count=N, erase\n");
+	myprintf("watch downloads new pictures as they are taken: poll=SECONDS (default 1) maxpoll=SECONDS\n");
+	myprintf("  (default 10, the interval stretches while nothing changes), count=N, q stops\n");
+	myprintf("sheet makes one BMP of all the thumbnails (or sheet start end, filters as get), named for the camera\n");
+	myprintf("verify checks the pictures in dir=DIR (default here) against the camera, sizes and JPEG markers,\n");
+	myprintf("  and downloads again only the bad ones (or verify start end, filters as get)\n");
+	myprintf("run executes each line of MANIFEST (as above, without the port, # for comments) in one session\n");
+	myprintf("Each picture downloaded is added to the index %s (index=FILE, noindex), see dcindex\n", INDEX_DEFAULT);
+	myprintf("On battery, STATUS is read between pictures. When it is low get goes smallest first, when empty\n");
+	myprintf("  downloads stop after the current picture\n");
+	myprintf("baud=N sets the download speed (9600 19200 38400 57600 115200, default 115200)\n");
+	myprintf("SIM faults as dcproxy: noise=%% drop=%% delay=MS jitter=MS ackdelay=MS frag=N busy=%% busylen=N seed=N\n");
+	myprintf("If rerunning and camera does not sync, try \"nobaud\" flag\nIf it still fails power-cycle camera.\n");
+	exit(1);
+}
+
+int parse_picnum(char *arg)
+{
+	// Returns -1 if not a valid integer
+	char *pargvpic = arg;
+	while (*pargvpic)
+	if (!isdigit(*pargvpic++))
+	{
+		myprintf("Picnum \"%s\" is not a valid integer\n", arg);
+		return -1;
+	}
+	return atoi(arg);
+}
+
+int parse_job(Job *job, int argc, char **argv)
+{
+	// argv[0] is the command. Returns 0 if invalid (message printed). NB argv is reordered
+	memset(job, 0, sizeof(*job));
+	filter_init(&job->filter);
+	job->sinkType = SINK_FILES;
+	job->last = -1;
+
+	// Strip the output and filter options first so the positional checks below are unaffected
+	char *sink_path = NULL;
+	int nargs = 1;
+	for (int i=1; i<argc; i++)
+	{
+		int isfilter = filter_option(&job->filter, argv[i]);
+		if (isfilter < 0)
+		{
+			myprintf("Invalid filter \"%s\"\n", argv[i]);
+			return 0;
 		}
+		else if (isfilter)
+			;
+		else if (!_strnicmp(argv[i],"tar=",4))
+			{ job->sinkType = SINK_TAR; sink_path = argv[i]+4; }
+		else if (!_strnicmp(argv[i],"zip=",4))
+			{ job->sinkType = SINK_ZIP; sink_path = argv[i]+4; }
+		else if (!_strnicmp(argv[i],"dir=",4))
+			{ job->sinkType = SINK_FILES; sink_path = argv[i]+4; }
+		else if (!_stricmp(argv[i],"stdout"))
+			{ job->sinkType = SINK_FILES; sink_path = "-"; }
+		else if (!_strnicmp(argv[i],"interval=",9) && atoi(argv[i]+9) > 0)
+			job->captureInterval = atoi(argv[i]+9) * 1000;
+		else if (!_strnicmp(argv[i],"count=",6) && atoi(argv[i]+6) > 0)
+			job->captureCount = atoi(argv[i]+6);
+		else if (!_stricmp(argv[i],"erase"))
+			job->captureErase = 1;
+		else if (!_stricmp(argv[i],"order=newest"))
+			job->order = ORDER_NEWEST;
+		else if (!_stricmp(argv[i],"order=oldest"))
+			job->order = ORDER_OLDEST;
+		else if (!_stricmp(argv[i],"order=smallest"))
+			job->order = ORDER_SMALLEST;
+		else if (!_stricmp(argv[i],"thumbs"))
+			job->thumbs = 1;
+		else if (!_strnicmp(argv[i],"poll=",5) && atof(argv[i]+5) > 0)
+			job->pollMin = (int)(atof(argv[i]+5) * 1000);
+		else if (!_strnicmp(argv[i],"maxpoll=",8) && atof(argv[i]+8) > 0)
+			job->pollMax = (int)(atof(argv[i]+8) * 1000);
 		else
+			argv[nargs++] = argv[i];
+	}
+	argc = nargs;
+
+	if (sink_path && !*sink_path)
+	{
+		myprintf("Missing output file or directory name\n");
+		return 0;
+	}
+	if (sink_path && strlen(sink_path) >= sizeof(job->sinkPath))
+	{
+		myprintf("Output name too long\n");
+		return 0;
+	}
+	if (sink_path)
+		strcpy(job->sinkPath, sink_path);
+
+	if (!_stricmp(argv[0],"status"))
+		job->cmd = JOB_STATUS;
+	else if (!_stricmp(argv[0],"list"))
+		job->cmd = JOB_LIST;
+	else if (!_stricmp(argv[0],"capture"))
+		job->cmd = JOB_CAPTURE;
+	else if (!_stricmp(argv[0],"watch"))
+		job->cmd = JOB_WATCH;
+	else if (!_stricmp(argv[0],"sheet") && argc == 1)
+		job->cmd = JOB_SHEET;
+	else if (!_stricmp(argv[0],"verify") && argc == 1)
+		job->cmd = JOB_VERIFY;
+	else if (!_stricmp(argv[0],"get") || !_stricmp(argv[0],"sheet") || !_stricmp(argv[0],"verify"))
+	{
+		job->cmd = !_stricmp(argv[0],"get") ? JOB_GET : !_stricmp(argv[0],"sheet") ? JOB_SHEET : JOB_VERIFY;
+		if (argc < 2 || argc > 3)
+			return 0;
+		if (!_stricmp(argv[1],"all"))
 		{
-			(VERBOSITY > 1) && myprintf("No data\n");
+			if (argc > 2)
+				return 0;
 		}
-
-		// if (seq >= 13)
-		if (seq >= 8)
-			Sleep(10);	// Try at 115200 baud
-			// Sleep(100);	// OK at 9600 baud
 		else
-			Sleep(500);	// Tried 200 but iffy at 115200 baud
-			// Sleep(500);	// OK at 9600 baud
+		{
+			if ((job->first = parse_picnum(argv[1])) < 0)
+				return 0;
+			job->last = job->first;
+			if (argc > 2 && (job->last = parse_picnum(argv[2])) < 0)
+				return 0;
+			if (job->last < job->first)
+				job->last = job->first;		// As before, get 5 2 just gets 5
+		}
+	}
+	else
+		return 0;
+
+	// Be rather more strict about extra parameters
+	if (job->cmd != JOB_GET && job->cmd != JOB_SHEET && job->cmd != JOB_VERIFY && argc > 1)
+		return 0;
+	if (job->cmd == JOB_VERIFY && (job->sinkType != SINK_FILES || !strcmp(job->sinkPath, "-")))
+	{
+		myprintf("verify works on a directory of pictures, dir=DIR\n");
+		return 0;
+	}
+	if ((job->captureInterval || job->captureErase) && job->cmd != JOB_CAPTURE)
+		return 0;
+	if (job->captureCount && job->cmd != JOB_CAPTURE && job->cmd != JOB_WATCH)
+		return 0;
+	if ((job->pollMin || job->pollMax) && job->cmd != JOB_WATCH)
+		return 0;
+	if (!job->pollMin)
+		job->pollMin = WATCH_POLL_MIN;
+	if (!job->pollMax)
+		job->pollMax = job->pollMin > WATCH_POLL_MAX ? job->pollMin : WATCH_POLL_MAX;
+	if (job->pollMax < job->pollMin)
+		job->pollMax = job->pollMin;
+	if ((job->order || job->thumbs) && job->cmd != JOB_GET)
+		return 0;
+	if (filter_active(&job->filter) && job->cmd != JOB_GET && job->cmd != JOB_SHEET && job->cmd != JOB_VERIFY)
+	{
+		myprintf("Filters only apply to get all, get start end, sheet and verify\n");
+		return 0;
+	}
+	return 1;
+}
+
+int load_manifest(char *fname, std::vector<Job> &jobs)
+{
+	// One job per line, words as on the command line after the port. Returns 0 if any line is bad
+	FILE *mfile = fopen(fname, "r");
+	if (!mfile)
+	{
+		myprintf("ERROR opening manifest %s\n", fname);
+		return 0;
+	}
+
+	char line[1024];
+	int lineno = 0;
+	int ok = 1;
+	while (fgets(line, sizeof(line), mfile))
+	{
+		lineno++;
+		char *hash = strchr(line, '#');
+		if (hash)
+			*hash = 0;
+
+		char *words[32];
+		int nwords = 0;
+		for (char *w = strtok(line, " \t\r\n"); w && nwords < 32; w = strtok(NULL, " \t\r\n"))
+			words[nwords++] = w;
+		if (!nwords)
+			continue;
+
+		Job job;
+		if (!_stricmp(words[0],"run") || !_stricmp(words[nwords-1],"nobaud") || !parse_job(&job, nwords, words))
+		{
+			myprintf("Invalid manifest line %d\n", lineno);
+			ok = 0;
+			continue;
+		}
+		job.line = lineno;
+		jobs.push_back(job);
+	}
+	fclose(mfile);
+	if (ok && jobs.empty())
+	{
+		myprintf("Manifest %s is empty\n", fname);
+		ok = 0;
+	}
+	return ok;
+}
+
+int job_range(Job *job, int *firstPicNum, int *lastPicNum)
+{
+	// Pictures a get or sheet covers. Returns 0 if the first is not in the camera (message printed)
+	*firstPicNum = job->first;
+	*lastPicNum = job->last < 0 ? numPictures - 1 : job->last;
+	if (*lastPicNum > numPictures - 1)
+		*lastPicNum = numPictures - 1;
+	if (*firstPicNum < filter_first(&job->filter, numPictures))
+		*firstPicNum = filter_first(&job->filter, numPictures);	// last=N
+	if (*firstPicNum >= numPictures)
+	{
+		(VERBOSITY > -1) && myprintf("Cannot info for picture %d (indexed from 0), only %d pictures in camera\n", *firstPicNum, numPictures);
+		return 0;
+	}
+	return 1;
+}
+
+void picture_sizes(Serial* SP, int first, int last, const std::vector<char> &done, std::vector<int> &sizes)
+{
+	// For ORDER_SMALLEST, PICTURE_INFO of those not done yet (256 bytes each, quick next to a picture)
+	int err;
+	sizes.assign(last + 1, 0);
+	for (int picnum=first; picnum<=last; picnum++)
+	{
+		if (picnum < (int)done.size() && done[picnum])
+			continue;
+		while ((err = get_picinfo(SP, picnum)) != DC_OK)
+			recover_or_exit(SP, err);
+		sizes[picnum] = pi_fileSize;
+	}
+}
+
+int run_get(Serial* SP, Job *job)
+{
+	int err;
+	int result = 0;
+	int firstPicNum, lastPicNum;
+	int numSkipped = 0;	// By filter
+	if (!job_range(job, &firstPicNum, &lastPicNum))
+		result = 1;
+
+	// Everything goes through the queue so the operator can jump it, see poll_requests()
+	WorkQueue work(job->order);
+	for (int picnum=firstPicNum; picnum<=lastPicNum; picnum++)
+	{
+		if (job->thumbs)
+			work.Add(WORK_THUMB, picnum, PRI_THUMB);
+		work.Add(WORK_PICTURE, picnum, PRI_BULK);
+	}
+	std::vector<char> done[2];		// By WORK_
+	done[WORK_PICTURE].resize(numPictures, 0);
+	done[WORK_THUMB].resize(numPictures, 0);
+	int order = job->order;
+	if (order == ORDER_SMALLEST)
+	{
+		std::vector<int> sizes;
+		picture_sizes(SP, firstPicNum, lastPicNum, done[WORK_PICTURE], sizes);
+		work.Reorder(order, sizes);
+	}
+	queue = &work;
+	stopRequested = 0;
+	requestLen = 0;
+	(VERBOSITY > -1) && myprintf("Type a picture number and Enter to fetch it next, q to stop\n");
 
-		// DC210 camera comms state machine (send to camera) 
+	while (!stopRequested && work.Size())
+	{
+		// Between pictures is the safe place to stop, and a low battery is best spent on the
+		// pictures that will finish soonest
+		int power = power_check(SP);
+		if (power == DC210_BATTERY_EMPTY)
+			break;
+		if (power == DC210_BATTERY_LOW && order != ORDER_SMALLEST)
+		{
+			(VERBOSITY > -1) && myprintf("Smallest pictures first\n");
+			std::vector<int> sizes;
+			picture_sizes(SP, firstPicNum, lastPicNum, done[WORK_PICTURE], sizes);
+			order = ORDER_SMALLEST;
+			work.Reorder(order, sizes);
+		}
 
-		if (seq == 0)
+		work.Next(&current);
+		if (current.picnum >= (int)done[current.kind].size())
 		{
-			if (no_setbaud)
-				seq = 2;
-			else
+			done[WORK_PICTURE].resize(current.picnum + 1, 0);	// Taken since the get started
+			done[WORK_THUMB].resize(current.picnum + 1, 0);
+		}
+		if (done[current.kind][current.picnum])
+		{
+			(VERBOSITY > -1) && current.priority == PRI_URGENT && myprintf("Picture %d already downloaded\n", current.picnum);
+			continue;
+		}
+		while ((err = get_picinfo(SP, current.picnum)) != DC_OK)
+			recover_or_exit(SP, err);
+		if (current.priority != PRI_URGENT && !filter_match(&job->filter, pi_resolution, pi_compression, pic_time()))
+		{
+			if (current.kind == WORK_PICTURE)
 			{
-				// (VERBOSITY > -1) && myprintf("Setting speed 19200 baud\n");
-				(VERBOSITY > -1) && myprintf("Setting speed 115200 baud\n");
-				// NB DC210 always starts at 9600 baud
-				seq++;
-				expectData = 1; // Set speed just responds with one byte ACK
-				// send_command(SP, DC_SET_SPEED, 0x96, 0, 0, 0);		// 9600 baud is default
-				// send_command(SP, DC_SET_SPEED, 0x19, 0x20, 0, 0);	// 19200
-				// send_command(SP, DC_SET_SPEED, 0x38, 0x40, 0, 0);	// 38400
-				// send_command(SP, DC_SET_SPEED, 0x57, 0x60, 0, 0);	// 57600
-				send_command(SP, DC_SET_SPEED, 0x11, 0x52, 0, 0);	// 115200
-
-				// NB We call SP->SetSpeed(CBR_115200); in seq==1
-				// CARE may need to power cycle camera if program aborts since still in high speed mode
+				(VERBOSITY > -1) && myprintf("Skipping %s (filter)\n", pi_fileName);
+				numSkipped++;
 			}
+			continue;
 		}
-		else if (seq == 2)
+
+		err = current.kind == WORK_THUMB ? fetch_thumbnail(SP, current.picnum) : fetch_picture(SP, current.picnum);
+		if (err == DC_ERR_CANCELLED)
 		{
-			if (0)
-				seq = 4;
-			else
+			if (!stopRequested)
 			{
-				// Initialise camera
-				(VERBOSITY > -1) && myprintf("Initializing camera\n");
-				seq++;
-				expectData = 2;
-				send_command(SP, DC210_INITIALIZE, 0, 0, 0, 0);
+				(VERBOSITY > -1) && myprintf("Put %s aside\n", pi_fileName);
+				work.Add(current.kind, current.picnum, current.priority);
 			}
-		} 
-		else if (seq == 4)
-		{
-			// Get status
-			checksum = 0;
-			(VERBOSITY > -1) && myprintf("Getting status\n");
-			// Returns 256 byte packet vis ACK, PKT_CTRL_RECV, 256 bytes packet, CHECKSUM
-			seq++;
-			expectData = 256+3;
-			send_command(SP, DC210_STATUS, 0, 0, 0, 0);
+			continue;
 		}
-		else if (seq == 6)
+		if (err != DC_OK)
+			result = 1;
+		done[current.kind][current.picnum] = 1;
+	}
+	queue = NULL;
+	if (stopRequested)
+		(VERBOSITY > -1) && myprintf("Stopped, %d downloads not done\n", work.Size() + 1);
+	else if (work.Size())
+	{
+		(VERBOSITY > -1) && myprintf("Battery empty, %d downloads not done\n", work.Size());
+		result = 1;
+	}
+	if (filter_active(&job->filter))
+		(VERBOSITY > -1) && myprintf("%d pictures downloaded, %d skipped by filter\n", numDownloaded, numSkipped);
+	return result;
+}
+
+int run_sheet(Serial* SP, Job *job)
+{
+	// The link is the slow part (a thumbnail is 20KB, seconds even at 115200) so each one is
+	// handed to the pool as it arrives and converted while the next downloads
+	int err;
+	int firstPicNum, lastPicNum;
+	if (!job_range(job, &firstPicNum, &lastPicNum))
+		return 1;
+
+	ThreadPool pool;
+	ContactSheet sheet(&pool);
+	for (int picnum=firstPicNum; picnum<=lastPicNum; picnum++)
+	{
+		if (filter_active(&job->filter))
 		{
-			// Respond with single byte DC_CORRECT_PACKET (TODO checksumming)
-			seq++;
-			expectData = 1;	// Expect DC_COMMAND_COMPLETE (0x00)
-			sprintf(outData,"%c",DC_CORRECT_PACKET);
-			SP->WriteData(outData,strlen(outData));
+			while ((err = get_picinfo(SP, picnum)) != DC_OK)
+				recover_or_exit(SP, err);
+			if (!filter_match(&job->filter, pi_resolution, pi_compression, pic_time()))
+				continue;
 		}
-		else if (seq == 8)
-		{
-			checksum = 0;
-			if (cmd_status)
-				break;		// Done
+		if (power_check(SP) == DC210_BATTERY_EMPTY)
+			break;		// The sheet has what there is
+		(VERBOSITY > -1) && myprintf("Thumbnail %d\n", picnum);
+		if ((err = download_thumbnail(SP, picnum)) == DC_ERR_LENGTH)
+			continue;
+		if (err != DC_OK)
+			return 1;
+		sheet.Add(fullData);
+	}
+	if (!sheet.Count())
+	{
+		(VERBOSITY > -1) && myprintf("No pictures for the contact sheet\n");
+		return 1;
+	}
+	int size = sheet.Finish();
+
+	// Named for the camera so sheets from several land side by side
+	char fname[40];
+	int len = 0;
+	for (char *c = cameraIdent; *c && len < 30; c++)
+		if (isalnum((unsigned char)*c))
+			fname[len++] = toupper(*c);
+		else if (len && fname[len-1] != '_')
+			fname[len++] = '_';
+	while (len && fname[len-1] == '_')
+		len--;
+	strcpy(fname + len, len ? ".BMP" : "SHEET.BMP");
+
+	if (!sink->Begin(fname, size, (long)time(NULL)) || !sink->Write(sheet.Data(), size) || !sink->End())
+	{
+		(VERBOSITY > -1) && myprintf("ERROR writing contact sheet %s\n", fname);
+		return 1;
+	}
+	(VERBOSITY > -1) && myprintf("%s written, %d thumbnails (converted on %d threads)\n", fname, sheet.Count(), pool.Threads());
+	return 0;
+}
 
-			(VERBOSITY > 0) && myprintf("Listing picture\n");
+// verify: the link is far too slow to download everything again to find the few bad pictures, so
+// the files are checked against PICTURE_INFO and for JPEG structure, and only the failures fetched
 
-			bytesDownloaded = 0;		// Reset buffer (in case looping on all pic download)
+struct Check
+{
+	int picnum;
+	char fileName[13];
+	char path[MAX_PATH];
+	int size;				// pi_fileSize
+	long found;				// Size of the file, -1 if there is none
+	const char *problem;	// NULL if the file is good
+};
+
+void check_file(void *arg)
+{
+	// On the pool, reading the files in parallel while the camera is asked about the next ones
+	Check *c = (Check*)arg;
+	FILE *f = fopen(c->path, "rb");
+	if (!f)
+	{
+		c->found = -1;
+		c->problem = "missing";
+		return;
+	}
+	fseek(f, 0, SEEK_END);
+	c->found = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (c->found != c->size)
+	{
+		fclose(f);
+		c->problem = c->found < c->size ? "too short" : "too long";
+		return;
+	}
+	std::vector<unsigned char> data(c->size);
+	size_t got = fread(&data[0], 1, c->size, f);
+	fclose(f);
+	c->problem = got != (size_t)c->size ? "read error" : jpeg_check(&data[0], c->size);
+}
 
-			// Currently 36 in camera, 0="DCP02099" 35="DCP02134"
-			// Pictures are indexed from 0
-			// Returns 256 byte packet vis ACK, PKT_CTRL_RECV, 256 bytes packet, CHECKSUM
+int run_verify(Serial* SP, Job *job)
+{
+	// Returns 0 if every picture is good (perhaps after fetching again)
+	int err;
+	int firstPicNum, lastPicNum;
+	if (!job_range(job, &firstPicNum, &lastPicNum))
+		return 1;
 
-			// Indexed from 0 - TODO pass this as a parameter
-			// int picnum = 35;
-			int picnum = wantPicNum;
-			if (picnum >= numPictures)
+	std::string dir = job->sinkPath[0] ? job->sinkPath : ".";
+	if (dir[dir.size()-1] != '\\' && dir[dir.size()-1] != '/')
+		dir += '\\';		// As FileSink
+
+	std::vector<Check> checks;
+	checks.reserve(lastPicNum - firstPicNum + 1);		// The pool has pointers into it
+	int numSkipped = 0;
+	{
+		ThreadPool pool;
+		for (int picnum=firstPicNum; picnum<=lastPicNum; picnum++)
+		{
+			while ((err = get_picinfo(SP, picnum)) != DC_OK)
+				recover_or_exit(SP, err);
+			if (!filter_match(&job->filter, pi_resolution, pi_compression, pic_time()))
 			{
-				(VERBOSITY > -1) && myprintf("Cannot info for picture %d (indexed from 0), only %d pictures in camera\n", picnum, numPictures);
-				return 1;
+				numSkipped++;
+				continue;
 			}
-			else
+			if (strncmp(pi_fileName,"DCP",3))
 			{
-				seq++;
-				expectData = 256+3;
-				send_command(SP, DC210_PICTURE_INFO, 0, picnum, 0, 0);	// NB arg1=msb arg2=lsb
+				(VERBOSITY > -1) && myprintf("Invalid filename %s for picture %d, not checked\n", pi_fileName, picnum);
+				continue;
 			}
+			Check c;
+			memset(&c, 0, sizeof(c));
+			c.picnum = picnum;
+			strcpy(c.fileName, pi_fileName);
+			_snprintf(c.path, sizeof(c.path)-1, "%s%s", dir.c_str(), pi_fileName);
+			c.size = pi_fileSize;
+			checks.push_back(c);
+			pool.Run(check_file, &checks.back());
+		}
+		pool.Wait();
+	}
+
+	std::vector<int> bad;
+	for (size_t i=0; i<checks.size(); i++)
+	{
+		Check *c = &checks[i];
+		if (!c->problem)
+			continue;
+		bad.push_back((int)i);
+		if (c->found >= 0 && c->found != c->size)
+			(VERBOSITY > -1) && myprintf("%s %s, %ld bytes, camera has %d\n", c->fileName, c->problem, c->found, c->size);
+		else
+			(VERBOSITY > -1) && myprintf("%s %s\n", c->fileName, c->problem);
+	}
+	(VERBOSITY > -1) && myprintf("%d pictures checked, %d bad%s\n", (int)checks.size(), (int)bad.size(),
+		numSkipped ? ", others skipped by filter" : "");
+
+	// Fetch again, and check what the camera sent before it replaces the file, as a bad copy on
+	// the card can't be repaired
+	int stillBad = 0;
+	for (size_t i=0; i<bad.size(); i++)
+	{
+		Check *c = &checks[bad[i]];
+		if (power_check(SP) == DC210_BATTERY_EMPTY)
+		{
+			stillBad += (int)(bad.size() - i);
+			break;
 		}
-		else if (seq == 10)
+		while ((err = get_picinfo(SP, c->picnum)) != DC_OK)
+			recover_or_exit(SP, err);
+		if (strcmp(pi_fileName, c->fileName))
 		{
-			// Respond with single byte DC_CORRECT_PACKET
-			seq++;
-			expectData = 1;	// Expect DC_COMMAND_COMPLETE (0x00)
-			(VERBOSITY > 1) && myprintf("Send DC_CORRECT_PACKET\n");
-			sprintf(outData,"%c",DC_CORRECT_PACKET);
-			SP->WriteData(outData,strlen(outData));
+			(VERBOSITY > -1) && myprintf("Picture %d is now %s, not fetched\n", c->picnum, pi_fileName);
+			stillBad++;
+			continue;
 		}
-		else if (seq == 12)
+		if (transfer_picture(SP, c->picnum) != DC_OK)
 		{
-			checksum = 0;
-			if (cmd_list)	// Loop over the pictures
-			{
-				wantPicNum++;
-				if (wantPicNum >= numPictures)
-					break;
-				seq = 8;
-			}
-			else
-			{
+			stillBad++;
+			continue;
+		}
+		const char *problem = jpeg_check((const unsigned char *)fullData, pi_fileSize);
+		if (problem)
+		{
+			(VERBOSITY > -1) && myprintf("%s as downloaded is bad too (%s), the camera's copy may be damaged, file left as it was\n", pi_fileName, problem);
+			stillBad++;
+			continue;
+		}
+		store_picture(c->picnum);
+	}
+	if (!bad.empty())
+		(VERBOSITY > -1) && myprintf("%d fetched again, %d still bad\n", (int)bad.size() - stillBad, stillBad);
+	return stillBad ? 1 : 0;
+}
 
-			// Download
-			// Returns 1024 byte packets vis ACK, PKT_CTRL_RECV, 1024 bytes packet, CHECKSUM
+int run_job(Serial* SP, Job *job)
+{
+	// Returns 0 if OK
+	int err;
+	int result = 0;
+	numDownloaded = 0;
+	bytesDownloaded = 0;
 
-			(VERBOSITY > 0) && myprintf("seq=12 bytesDownloaded %d pi_fileSize %d\n", bytesDownloaded, pi_fileSize);
+	if (powerStop && job->cmd != JOB_STATUS && job->cmd != JOB_LIST)
+	{
+		(VERBOSITY > -1) && myprintf("Skipped, battery empty\n");
+		return 1;
+	}
 
-			if (pi_fileSize <= 1024)		// Just check its more than a block (it will be)
-			{
-				(VERBOSITY > -1) && myprintf("ERROR pi_fileSize %d too small\n", pi_fileSize);
-				return 1;
-			}
+	if (job->cmd == JOB_GET || job->cmd == JOB_CAPTURE || job->cmd == JOB_WATCH || job->cmd == JOB_SHEET ||
+		job->cmd == JOB_VERIFY)
+	{
+		sink = open_sink(job->sinkType, job->sinkPath[0] ? job->sinkPath : NULL);
+		if (!sink)
+			return 1;
+		sinkKind = job->sinkType;
+		if (!strcmp(job->sinkPath, "-"))
+			strcpy(sinkWhere, "-");
+		else if (!_fullpath(sinkWhere, job->sinkPath[0] ? job->sinkPath : ".", MAX_PATH))
+			strcpy(sinkWhere, job->sinkPath);
+	}
 
-			// Be sure not to overrun buffer (TODO allocate memory instead)
-			if (pi_fileSize > sizeof(fullData) - 8192 * 2)	// A bit arbitary
-			{
-				(VERBOSITY > -1) && myprintf("ERROR pi_fileSize %d too large\n", pi_fileSize);
-				return 1;
-			}
-			
-			int picnum = wantPicNum;
-			if (picnum >= numPictures)
-			{
-				(VERBOSITY > -1) && myprintf("Cannot download picture %d (indexed from 0), only %d pictures in camera\n", picnum, numPictures);
-				return 1;
-			}
+	if (job->cmd == JOB_STATUS)
+	{
+		while ((err = get_status(SP)) != DC_OK)
+			recover_or_exit(SP, err);
+	}
+	else if (job->cmd == JOB_LIST)
+	{
+		for (int picnum=0; picnum<numPictures; picnum++)
+			while ((err = get_picinfo(SP, picnum)) != DC_OK)
+				recover_or_exit(SP, err);
+	}
+	else if (job->cmd == JOB_GET)
+		result = run_get(SP, job);
+	else if (job->cmd == JOB_CAPTURE)
+		capture(SP, job->captureInterval, job->captureCount, job->captureErase);
+	else if (job->cmd == JOB_WATCH)
+		watch(SP, job->pollMin, job->pollMax, job->captureCount);
+	else if (job->cmd == JOB_SHEET)
+		result = run_sheet(SP, job);
+	else if (job->cmd == JOB_VERIFY)
+		result = run_verify(SP, job);
+
+	if (sink)
+	{
+		if (!sink->Close())
+		{
+			(VERBOSITY > -1) && myprintf("ERROR closing archive\n");
+			result = 1;
+		}
+		delete sink;
+		sink = NULL;
+	}
+	return result;
+}
 
-			if (bytesDownloaded >= pi_fileSize)	// This won't occur here as only run once, see seq==14
-			{
-				(VERBOSITY > -1) && myprintf("ERROR bytesDownloaded >= pi_fileSize not expected for first packet\n");
-				(VERBOSITY > -1) && myprintf("Downloaded %d cf %d expected\n", bytesDownloaded, pi_fileSize);
-				break;
-			}
-			// DO NOT DO THIS ... packet is ALWAYS 1024 bytes ...
-			// if (pi_fileSize - bytesDownloaded < 1024)
-			//	 expectData=pi_fileSize - bytesDownloaded+3;
-			// else
-			expectData=1024+3;
-			lastExpectData = expectData-3;
-			seq++;
-			send_command(SP, DC210_PICTURE_DOWNLOAD, 0, picnum, 0, 0);	// NB arg1=msb arg2=lsb
-			
-			} // End else cmd_list
-		}
-		else if (seq == 14)
-		{
-			checksum = 0;
-			bytesDownloaded += lastExpectData;
-			
-			if (dbgfile && (dbgpos < bytesDownloaded))					// DEBUGGING - dump data as we go
-			{
-				fwrite(fullData+dbgpos, bytesDownloaded-dbgpos, 1, dbgfile);
-				dbgpos=bytesDownloaded;
-				fflush(dbgfile);
-			}
-			
-			(VERBOSITY > 0) && myprintf("bytesDownloaded %d pi_fileSize %d\n", bytesDownloaded, pi_fileSize);
-			if (VERBOSITY == 0) { myprintf("."); fflush(stdout); }	// Progress as line of dots
-			
-			// Respond with single byte DC_CORRECT_PACKET
-			if (bytesDownloaded >= pi_fileSize)
-			{
-				// This is NORMAL since fixed 1024 byte packets
-				// if (bytesDownloaded > pi_fileSize)
-				//	 (VERBOSITY > -1) && myprintf("Download too much data %d cf %d expected\n", bytesDownloaded, pi_fileSize);
-				// else
-				(VERBOSITY == 0) && myprintf("\n");	// End line of dots
-				(VERBOSITY > -1) && myprintf("Download done\n");
-				// Write the file then exit
-				char *fname = pi_fileName;
-				if (strncmp(pi_fileName,"DCP",3))
-				{
-					fname = PICFILE_DEFAULT;
-					(VERBOSITY > -1) && myprintf("Invalid filename %s, using %s instead\n",pi_fileName,fname);
-				}
-				FILE *ofile = fopen(fname,"wb");
-				if (!ofile)
-				{
-					(VERBOSITY > -1) && myprintf("ERROR opening output file %s\n", fname);
-					exit(1);
-				}
-				fwrite(fullData, pi_fileSize, 1, ofile);
-				fclose(ofile);
-				(VERBOSITY > -1) && myprintf("%s file written\n", fname);
-				
-				noACK = 0;			// Reset for next pic
-				bytesDownloaded = 0;
-				if (cmd_all)
-				{
-					seq++;
-					expectData = 1;	// Expect DC_COMMAND_COMPLETE (0x00)
-					(VERBOSITY > 1) && myprintf("Send DC_CORRECT_PACKET\n");
-					sprintf(outData,"%c",DC_CORRECT_PACKET);
-					SP->WriteData(outData,strlen(outData));
-				}
-				else
-				{
-					break;		// Exit
-					// seq++;	// Alternatively just step on to NULL sequence (15)
-				}
-			}
-			else
-			{
-				// DO NOT DO THIS ... packet is ALWAYS 1024 bytes ...
-				// if (pi_fileSize - bytesDownloaded < 1024)
-				//	 expectData=pi_fileSize - bytesDownloaded+2;
-				// else
-				expectData=1024+2;	// NB We lose the ACK in this packet
-				lastExpectData = expectData-2;
-				noACK = 1;
-				(VERBOSITY > 1) && myprintf("Send DC_CORRECT_PACKET\n");
-				sprintf(outData,"%c",DC_CORRECT_PACKET);
-				SP->WriteData(outData,strlen(outData));
-					seq--;		// Go back to finish it
-			}
+int _tmain(int argc, _TCHAR* argv[])
+{
+	// Process arguments, ought really to use getopt here (nobaud is an outlier, ought to be a switch)
+
+	int scanning = argc > 1 && !_stricmp(argv[1],"scan");
+	if (argc < 3 && !scanning)
+		usage();
+
+	if (!_stricmp(argv[argc-1],"nobaud"))
+	{
+		no_setbaud = 1;
+		argc--;
+	}
+
+	int simulate = !_stricmp(argv[1],"SIM") || (scanning && argc > 2 && !_stricmp(argv[2],"SIM"));
+	sim_init(&simcfg);
+	int nargs = 2;
+	for (int i=2; i<argc; i++)
+	{
+		// Session options, the rest are for the job
+		int r = simulate ? sim_option(&simcfg, argv[i]) : 0;
+		if (r < 0)
+		{
+			myprintf("Invalid simulator option \"%s\"\n", argv[i]);
+			usage();
+		}
+		else if (r)
+			;
+		else if (!_strnicmp(argv[i],"index=",6) && argv[i][6])
+		{
+			indexFile = argv[i]+6;
+			indexGiven = 1;
+		}
+		else if (!_stricmp(argv[i],"noindex"))
+		{
+			indexFile = NULL;
+			indexGiven = 1;
 		}
-		else if (seq == 16)
+		else if (simulate && !_strnicmp(argv[i],"simlog=",7))
+			simlog = argv[i][7] ? argv[i]+7 : SIM_LOG_DEFAULT;
+		else if (!_strnicmp(argv[i],"baud=",5))
 		{
-			if (cmd_all)	// Sanity check
+			targetSpeed = atoi(argv[i]+5);
+			if (targetSpeed != CBR_9600 && targetSpeed != CBR_19200 && targetSpeed != CBR_38400 &&
+				targetSpeed != CBR_57600 && targetSpeed != CBR_115200)
 			{
-				wantPicNum++;
-				if (wantPicNum >= numPictures || (cmd_range && wantPicNum > wantLastPicNum))
-						break;
-				seq = 8;		// Loop back for next pic info (not pic download since need size/name)
+				myprintf("Invalid baud rate \"%s\"\n", argv[i]+5);
+				usage();
 			}
-			else
+		}
+		else
+			argv[nargs++] = argv[i];
+	}
+	argc = nargs;
+
+	if (scanning)
+	{
+		// Before anything else, each port is a separate session
+		for (int i=2; i<argc; i++)
+			if (simulate ? argc != 3 : (strlen(argv[i]) < 4 || strlen(argv[i]) > 6 || _strnicmp(argv[i],"COM",3) || !isdigit(argv[i][3])))
 			{
-				(VERBOSITY > 1) && myprintf("ERROR seq==16 but NOT cmd_all\n");
+				myprintf("Invalid port \"%s\" for scan, COMn only (or SIM on its own)\n", argv[i]);
+				usage();
 			}
-		}	// End if seq
-	}	// End While
+		if (simulate)
+			clock_virtual();
+		return scan(argc-2, argv+2);
+	}
+	if (argc < 3)
+		usage();
+
+	char comport[20];
+	if (simulate)
+	{
+		clock_virtual();		// Before anything is timed
+		if (!indexGiven)
+			indexFile = NULL;	// Only if asked for, simulated pictures don't belong in the real one
+	}
+	else if (strlen(argv[1]) < 3 || strlen(argv[1]) > 5)
+	{
+		myprintf("Port name too %s, 3-5 chars only\n", strlen(argv[1]) < 3 ? "short" : "long");
+		usage();
+	}
+	else
+	{
+		sprintf(comport,"\\\\.\\%s", argv[1]);
+		comport[4] = toupper(comport[4]);
+		comport[5] = toupper(comport[5]);
+		comport[6] = toupper(comport[6]);
+
+		if (strncmp(comport+4,"COM",3))
+		{
+			myprintf("Port name invalid, must be COM\n");
+			usage();
+		}
+	}
+
+	std::vector<Job> jobs;
+	if (!_stricmp(argv[2],"run"))
+	{
+		if (argc != 4 || !load_manifest(argv[3], jobs))
+			usage();
+	}
+	else
+	{
+		Job job;
+		if (argc < 3 || !parse_job(&job, argc-2, argv+2))
+			usage();
+		jobs.push_back(job);
+	}
+
+	for (size_t i=0; i<jobs.size(); i++)
+		if (!strcmp(jobs[i].sinkPath,"-"))
+			msgout = stderr;	// Keep stdout clean for the picture data
+
+	myprintf("Connecting to serial port %s\n", argv[1]);
+
+	// Baud rate is set to 9600 in serial.cpp to match DC210 initial rate
+	Serial* SP;
+	if (simulate)
+		SP = sim = new SimSerial(&simcfg);
+	else
+		SP = new Serial(comport);
+
+	if (SP->IsConnected())
+	{
+		myprintf("We're connected\n");
+	}
+	else
+	{
+		myprintf("ERROR not connected\n");
+		return 1;
+	}
+
+	DWORD startTick = dc_ticks();
+	sessionStart = (unsigned long)time(NULL);
+	int result = 0;
+	int err;
+
+	if (no_setbaud)
+	{
+		SP->SetSpeed(targetSpeed);	// Camera is already at speed, so set port baudrate
+		portSpeed = targetSpeed;
+	}
+
+	// NB If we get packet handling wrong the camera may hang, dc_recover() should bring it back
+	// without needing the battery's out to reset
+
+	// One session for all the jobs, the speed change and initialize are only done once
+	while ((err = session_start(SP)) != DC_OK)
+		recover_or_exit(SP, err);
+	while ((err = get_status(SP)) != DC_OK)
+		recover_or_exit(SP, err);
+	power_note();
+
+	long totalBytes = 0;
+	for (size_t i=0; i<jobs.size(); i++)
+	{
+		Job *job = &jobs[i];
+		DWORD jobTick = dc_ticks();
+		int failed = 0;
+		if (job->line)
+			(VERBOSITY > -1) && myprintf("Step %d (manifest line %d)\n", (int)i+1, job->line);
+		if (job->cmd == JOB_STATUS && !i)
+			;	// Status was just read
+		else if ((failed = run_job(SP, job)) != 0)
+			result = 1;
+		totalBytes += bytesDownloaded;
+		if (job->line)
+			(VERBOSITY > -1) && myprintf("Step %d %s, %d pictures, %ld bytes, %lu ms\n", (int)i+1,
+				failed ? "FAILED" : "OK", numDownloaded, bytesDownloaded, dc_ticks() - jobTick);
+	}
+
+	DWORD elapsed = dc_ticks() - startTick;
+	totalBytes && (VERBOSITY > -1) && myprintf("Session %lu ms, %ld picture bytes (%ld bytes/s)\n",
+		elapsed, totalBytes, elapsed ? totalBytes * 1000 / (long)elapsed : 0);
 
 	if (1)
 	{
 		// Reset speed else camera will need power cycling on next run
 		(VERBOSITY > -1) && myprintf("Resetting speed to 9600 baud\n");
 		send_command(SP, DC_SET_SPEED, 0x96, 0, 0, 0);
-		Sleep(200);
+		dc_sleep(200);
 		// Don't check response
 	}
 	else
 	{
-		(VERBOSITY > -1) && myprintf("WARNING camera is still at 115200 baud, use \"nobaud\" flag if rerunning\n");
+		(VERBOSITY > -1) && myprintf("WARNING camera is still at %d baud, use \"nobaud\" flag if rerunning\n", targetSpeed);
 	}
 
-	return 0;
+	sim_report(result, totalBytes);
+
+	return result;
 }
@@ -0,0 +1,101 @@
+// pool.cpp	- Small fixed pool of worker threads
+
+// Used for the CPU work that can run alongside the serial link (which is single threaded, it is
+// one camera talking at the speed of the port). Tasks are plain functions so nothing needs more
+// than VS2008 has.
+
+#include <process.h>
+#include "pool.h"
+
+ThreadPool::ThreadPool(int nthreads) : pending(0)
+{
+	if (nthreads <= 0)
+		nthreads = Processors();
+	if (nthreads > MAXIMUM_WAIT_OBJECTS)
+		nthreads = MAXIMUM_WAIT_OBJECTS;
+	InitializeCriticalSection(&lock);
+	work = CreateSemaphore(NULL, 0, 0x7FFFFFFF, NULL);
+	idle = CreateEvent(NULL, TRUE, TRUE, NULL);
+	for (int i=0; i<nthreads; i++)
+	{
+		HANDLE h = (HANDLE)_beginthreadex(NULL, 0, Worker, this, 0, NULL);
+		if (h)
+			threads.push_back(h);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	Wait();
+	// An empty queue tells a worker to finish, so one count each
+	if (!threads.empty())
+	{
+		ReleaseSemaphore(work, (LONG)threads.size(), NULL);
+		WaitForMultipleObjects((DWORD)threads.size(), &threads[0], TRUE, INFINITE);
+	}
+	for (size_t i=0; i<threads.size(); i++)
+		CloseHandle(threads[i]);
+	CloseHandle(work);
+	CloseHandle(idle);
+	DeleteCriticalSection(&lock);
+}
+
+unsigned __stdcall ThreadPool::Worker(void *p)
+{
+	ThreadPool *pool = (ThreadPool*)p;
+	for (;;)
+	{
+		WaitForSingleObject(pool->work, INFINITE);
+		EnterCriticalSection(&pool->lock);
+		if (pool->tasks.empty())
+		{
+			LeaveCriticalSection(&pool->lock);
+			return 0;
+		}
+		Task t = pool->tasks.front();
+		pool->tasks.pop_front();
+		LeaveCriticalSection(&pool->lock);
+
+		t.fn(t.arg);
+
+		EnterCriticalSection(&pool->lock);
+		if (--pool->pending == 0)
+			SetEvent(pool->idle);
+		LeaveCriticalSection(&pool->lock);
+	}
+}
+
+void ThreadPool::Run(TaskFn fn, void *arg)
+{
+	if (threads.empty())
+	{
+		fn(arg);	// No threads to be had, just do it here
+		return;
+	}
+	Task t;
+	t.fn = fn;
+	t.arg = arg;
+	EnterCriticalSection(&lock);
+	tasks.push_back(t);
+	if (pending++ == 0)
+		ResetEvent(idle);
+	LeaveCriticalSection(&lock);
+	ReleaseSemaphore(work, 1, NULL);
+}
+
+void ThreadPool::Wait()
+{
+	WaitForSingleObject(idle, INFINITE);
+}
+
+int ThreadPool::Threads()
+{
+	return (int)threads.size();
+}
+
+int ThreadPool::Processors()
+{
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return si.dwNumberOfProcessors > 0 ? (int)si.dwNumberOfProcessors : 1;
+}
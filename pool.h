@@ -0,0 +1,39 @@
+// pool.h	- Small fixed pool of worker threads
+
+#ifndef POOL_H_INCLUDED
+#define POOL_H_INCLUDED
+
+#include <windows.h>
+#include <vector>
+#include <deque>
+
+typedef void (*TaskFn)(void *arg);
+
+class ThreadPool
+{
+	private:
+		struct Task
+		{
+			TaskFn fn;
+			void *arg;
+		};
+		std::vector<HANDLE> threads;
+		std::deque<Task> tasks;
+		CRITICAL_SECTION lock;
+		HANDLE work;		// Semaphore, counts queued tasks (and the stop)
+		HANDLE idle;		// Manual reset event, set while nothing is queued or running
+		int pending;		// Queued or running
+		static unsigned __stdcall Worker(void *pool);
+	public:
+		// 0 threads for one per processor
+		ThreadPool(int nthreads = 0);
+		// Waits for the tasks then stops the threads
+		~ThreadPool();
+		// fn(arg) is run on one of the threads, arg must stay valid until Wait()
+		void Run(TaskFn fn, void *arg);
+		void Wait();
+		int Threads();
+		static int Processors();
+};
+
+#endif // POOL_H_INCLUDED
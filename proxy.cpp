@@ -0,0 +1,200 @@
+// proxy.cpp	- Fault injecting serial proxy for benchmarking dc210 error recovery
+
+// Sits between dc210 and the camera (or an emulator). dc210 talks to one end of a virtual null
+// modem pair (eg com0com), the proxy to the other end and to the real camera port:
+//
+//    dc210 COM5 <-> COM6 dcproxy COM1 <-> camera
+//
+// Bytes are forwarded with the configured faults and each session (traffic bracketed by idle
+// time) is summarised to the console and appended to a CSV log, so the cost of each kind of
+// fault on total transfer time can be compared against a fault free run.
+
+#include <stdio.h>
+#include <ctype.h>
+#include <time.h>
+#include <tchar.h>
+#include "SerialClass.h"
+#include "clock.h"
+#include "faults.h"
+
+#define PROXY_LOG "proxy.csv"
+#define PROXY_IDLE 3000		// ms of silence that ends a session
+
+#define DC_SET_SPEED     0x41
+#define DC_COMMAND_ACK   0xD1
+
+void usage()
+{
+	printf("Usage: dcproxy TOOLPORT CAMERAPORT [fault options] [both] [idle=MS] [log=FILE]\n");
+	printf("Faults (applied camera->tool, or both ways with \"both\"):\n");
+	printf("  noise=%% drop=%% delay=MS jitter=MS ackdelay=MS frag=BYTES busy=%% busylen=N seed=N\n");
+	exit(1);
+}
+
+Serial *open_port(char *name)
+{
+	char comport[20];
+	_snprintf(comport, sizeof(comport), "\\\\.\\%s", name);
+	comport[sizeof(comport)-1] = 0;
+	for (char *p=comport+4; *p; p++)
+		*p = toupper(*p);
+	Serial *SP = new Serial(comport);
+	if (!SP->IsConnected())
+	{
+		printf("ERROR not connected to %s\n", name);
+		exit(1);
+	}
+	return SP;
+}
+
+int speed_code(unsigned char *cmd)
+{
+	// DC_SET_SPEED arguments as sent by dc210 main.cpp, returns CBR_ value or 0
+	if (cmd[2] == 0x96) return CBR_9600;
+	if (cmd[2] == 0x19 && cmd[3] == 0x20) return CBR_19200;
+	if (cmd[2] == 0x38 && cmd[3] == 0x40) return CBR_38400;
+	if (cmd[2] == 0x57 && cmd[3] == 0x60) return CBR_57600;
+	if (cmd[2] == 0x11 && cmd[3] == 0x52) return CBR_115200;
+	return 0;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	if (argc < 3)
+		usage();
+
+	FaultConfig cfg;
+	faults_init(&cfg);
+	int both = 0;
+	int idle = PROXY_IDLE;
+	char *logname = PROXY_LOG;
+
+	for (int i=3; i<argc; i++)
+	{
+		int r = faults_option(&cfg, argv[i]);
+		if (r < 0)
+		{
+			printf("Invalid fault option \"%s\"\n", argv[i]);
+			usage();
+		}
+		else if (r)
+			;
+		else if (!_stricmp(argv[i], "both"))
+			both = 1;
+		else if (!_strnicmp(argv[i], "idle=", 5) && atoi(argv[i]+5) > 0)
+			idle = atoi(argv[i]+5);
+		else if (!_strnicmp(argv[i], "log=", 4) && argv[i][4])
+			logname = argv[i]+4;
+		else
+			usage();
+	}
+
+	FaultConfig none;
+	faults_init(&none);
+	FaultInjector down(&cfg);				// camera -> tool
+	FaultInjector up(both ? &cfg : &none);	// tool -> camera
+
+	char desc[256];
+	faults_describe(&cfg, desc, sizeof(desc));
+	printf("Proxy %s <-> %s %s%s\n", argv[1], argv[2], desc, both ? " both" : "");
+
+	Serial *tool = open_port(argv[1]);
+	Serial *cam = open_port(argv[2]);
+
+	char buf[8192];
+	unsigned char window[8] = {0};	// Last 8 bytes from tool, to spot DC_SET_SPEED
+	int pendingSpeed = 0;			// Switch both ports once the camera ACKs it
+	int session = 0;
+	DWORD sessionStart = 0;
+	DWORD lastTraffic = 0;
+	long upBytes = 0;
+	long downBytes = 0;
+	int n;
+
+	while (1)
+	{
+		DWORD now = dc_ticks();
+
+		if ((n = tool->ReadData(buf, sizeof(buf))) > 0)
+		{
+			if (!session)
+			{
+				session = 1;
+				sessionStart = now;
+				upBytes = downBytes = 0;
+				up.ResetStats();
+				down.ResetStats();
+				printf("Session started\n");
+			}
+			for (int i=0; i<n; i++)
+			{
+				memmove(window, window+1, 7);
+				window[7] = buf[i];
+				if (window[1] == 0 && window[6] == 0 && window[7] == 0x1A)
+					down.Command();		// The camera's next byte is the reply, see FaultInjector
+				if (window[0] == DC_SET_SPEED && window[1] == 0 && window[7] == 0x1A && speed_code(window))
+					pendingSpeed = speed_code(window);
+			}
+			upBytes += n;
+			lastTraffic = now;
+			up.Put(buf, n, now);
+		}
+
+		if ((n = cam->ReadData(buf, sizeof(buf))) > 0)
+		{
+			downBytes += n;
+			lastTraffic = now;
+			down.Put(buf, n, now);
+		}
+
+		while ((n = up.Get(buf, sizeof(buf), now)) > 0)
+			cam->WriteData(buf, n);
+
+		while ((n = down.Get(buf, sizeof(buf), now)) > 0)
+		{
+			tool->WriteData(buf, n);
+			if (pendingSpeed && memchr(buf, DC_COMMAND_ACK, n))
+			{
+				printf("Switching to %d baud\n", pendingSpeed);
+				dc_sleep(50);		// Let the ACK drain at the old speed
+				tool->SetSpeed(pendingSpeed);
+				cam->SetSpeed(pendingSpeed);
+				pendingSpeed = 0;
+			}
+		}
+
+		if (session && up.Idle() && down.Idle() && now - lastTraffic > (DWORD)idle)
+		{
+			// Session over, idle time is not counted
+			DWORD duration = lastTraffic - sessionStart;
+			printf("Session %lu ms, %ld bytes up, %ld bytes down, corrupted %ld dropped %ld fragments %ld busy %ld delay %ld ms\n",
+				duration, upBytes, downBytes,
+				down.stats.corrupted + up.stats.corrupted, down.stats.dropped + up.stats.dropped,
+				down.stats.fragments + up.stats.fragments, down.stats.busy + up.stats.busy,
+				down.stats.delayms + up.stats.delayms);
+
+			FILE *log = fopen(logname, "a");
+			if (log)
+			{
+				fseek(log, 0, SEEK_END);
+				if (!ftell(log))
+					fprintf(log, "time,config,both,duration_ms,up_bytes,down_bytes,corrupted,dropped,fragments,busy,delay_ms\n");
+				fprintf(log, "%ld,\"%s\",%d,%lu,%ld,%ld,%ld,%ld,%ld,%ld,%ld\n", (long)time(NULL), desc, both,
+					duration, upBytes, downBytes,
+					down.stats.corrupted + up.stats.corrupted, down.stats.dropped + up.stats.dropped,
+					down.stats.fragments + up.stats.fragments, down.stats.busy + up.stats.busy,
+					down.stats.delayms + up.stats.delayms);
+				fclose(log);
+			}
+			else
+				printf("ERROR opening log file %s\n", logname);
+
+			// NB Port speed is left alone, if dc210 aborted at 115200 so did the camera ("nobaud")
+			session = 0;
+		}
+
+		dc_sleep(1);
+	}
+
+	return 0;
+}
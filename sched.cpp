@@ -0,0 +1,91 @@
+// sched.cpp	- Prioritised queue of downloads for one camera session
+
+// The camera does one transfer at a time, so all the scheduling is deciding what goes next and
+// whether to abandon the transfer in progress (with PKT_CTRL_CANCEL, see download_block() in
+// main.cpp). A card holds at most a few hundred pictures so a set is plenty.
+
+#include "sched.h"
+
+bool WorkItem::operator<(const WorkItem &w) const
+{
+	if (priority != w.priority)
+		return priority < w.priority;
+	if (key != w.key)
+		return key < w.key;
+	if (kind != w.kind)
+		return kind < w.kind;
+	return picnum < w.picnum;		// Only for equal sizes in ORDER_SMALLEST
+}
+
+WorkQueue::WorkQueue(int order) : order(order)
+{
+}
+
+int WorkQueue::Key(int picnum)
+{
+	if (order == ORDER_SMALLEST && picnum < (int)sizes.size())
+		return sizes[picnum];
+	return order == ORDER_NEWEST ? -picnum : picnum;
+}
+
+void WorkQueue::Add(int kind, int picnum, int priority)
+{
+	std::set<WorkItem>::iterator i;
+	for (i=items.begin(); i!=items.end(); ++i)
+		if (i->kind == kind && i->picnum == picnum)
+		{
+			if (i->priority <= priority)
+				return;
+			items.erase(i);
+			break;
+		}
+
+	WorkItem w;
+	w.priority = priority;
+	w.key = Key(picnum);
+	w.kind = kind;
+	w.picnum = picnum;
+	items.insert(w);
+}
+
+bool WorkQueue::Next(WorkItem *w)
+{
+	if (items.empty())
+		return false;
+	*w = *items.begin();
+	items.erase(items.begin());
+	return true;
+}
+
+bool WorkQueue::Preempts(WorkItem *current)
+{
+	while (!items.empty() && items.begin()->priority < current->priority)
+	{
+		const WorkItem &w = *items.begin();
+		if (w.kind != current->kind || w.picnum != current->picnum)
+			return true;
+		current->priority = w.priority;
+		items.erase(items.begin());
+	}
+	return false;
+}
+
+int WorkQueue::Size()
+{
+	return (int)items.size();
+}
+
+void WorkQueue::Reorder(int order, const std::vector<int> &sizes)
+{
+	this->order = order;
+	this->sizes = sizes;
+	std::set<WorkItem> old;
+	old.swap(items);
+	std::set<WorkItem>::iterator i;
+	for (i=old.begin(); i!=old.end(); ++i)
+	{
+		WorkItem w = *i;
+		w.key = Key(w.picnum);
+		items.insert(w);
+	}
+}
@@ -0,0 +1,52 @@
+// sched.h	- Prioritised queue of downloads for one camera session
+
+#ifndef SCHED_H_INCLUDED
+#define SCHED_H_INCLUDED
+
+#include <set>
+#include <vector>
+
+#define WORK_PICTURE	0
+#define WORK_THUMB		1
+
+// Lower runs first
+#define PRI_URGENT		0		// Asked for by the operator during the get
+#define PRI_THUMB		1		// Thumbnails before full pictures ("thumbs")
+#define PRI_BULK		2
+
+#define ORDER_OLDEST	0		// Within a priority, by picture number (the original order)
+#define ORDER_NEWEST	1
+#define ORDER_SMALLEST	2		// By size, so the most complete pictures in the least time
+
+struct WorkItem
+{
+	int priority;		// PRI_
+	int key;			// Order within the priority
+	int kind;			// WORK_
+	int picnum;
+	bool operator<(const WorkItem &w) const;
+};
+
+class WorkQueue
+{
+	private:
+		std::set<WorkItem> items;
+		int order;
+		std::vector<int> sizes;		// By picnum, for ORDER_SMALLEST
+		int Key(int picnum);
+	public:
+		WorkQueue(int order);
+		// Queue kind/picnum, or move it up if it is already queued at a lower priority
+		void Add(int kind, int picnum, int priority);
+		// Take the head of the queue, false if empty
+		bool Next(WorkItem *w);
+		// Is something more urgent than current waiting (so current should be abandoned). A request
+		// for current itself just raises its priority, restarting it would throw away the progress
+		bool Preempts(WorkItem *current);
+		int Size();
+		// Change the order of what is queued and what is added later. sizes (by picnum) are only
+		// needed for ORDER_SMALLEST
+		void Reorder(int order, const std::vector<int> &sizes);
+};
+
+#endif // SCHED_H_INCLUDED
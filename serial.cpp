@@ -3,6 +3,7 @@
 // Serial.cpp (source code file)
 
 #include "SerialClass.h"
+#include "clock.h"
 
 Serial::Serial(char *portName)
 {
@@ -65,7 +66,7 @@ Serial::Serial(char *portName)
                  this->connected = true;
                  //We wait 2s as the arduino board will be reseting
                  //Sleep(ARDUINO_WAIT_TIME);
-				 Sleep(500);
+				 dc_sleep(500);
              }
         }
     }
@@ -174,7 +175,7 @@ bool Serial::SetSpeed(int speed)	// Use CBR_ constants
 		 }
 		 else
 		 {
-			 Sleep(500);
+			 dc_sleep(500);
 		 }
 	}
 	return true;
@@ -0,0 +1,588 @@
+// sim.cpp	- Simulated DC210 on a simulated serial line, run in virtual time (see clock.h)
+
+// The camera follows the protocol in dc210.cpp from the camera's side. Nothing happens on its
+// own, the simulation is brought up to date (Advance) whenever the host touches the port, and
+// the time each byte or job takes is worked out from the time it started, so the result does not
+// depend on how often the host polls.
+
+#include <stdio.h>
+#include <string.h>
+#include "dc210.h"
+#include "clock.h"
+#include "sim.h"
+#include "thumb.h"
+
+// Camera timings in ms (guesses, the DC210 has not been measured)
+#define SIM_ACK_MS        5		// Command to DC_COMMAND_ACK
+#define SIM_BUSY_EVERY    500	// DC_BUSY while working
+#define SIM_INIT_MS       1500
+#define SIM_STATUS_MS     30
+#define SIM_INFO_MS       50
+#define SIM_CARD_MS       400	// Find a picture on the card
+#define SIM_PACKET_MS     15	// Read each further 1024 bytes from the card
+#define SIM_THUMB_MS      300
+#define SIM_TAKE_MS       3000
+#define SIM_ERASE_MS      400	// Per picture
+#define SIM_GAP_MS        100	// A gap this long within a command makes the camera start again
+
+#define SIM_CLOCK_START   ((959817600UL - DC210_EPOC) * DC210_TICKS_PER_SEC)	// 1 Jun 2000
+
+void sim_init(SimConfig *cfg)
+{
+	cfg->pictures = 8;
+	cfg->shoot = 0;
+	cfg->both = 0;
+	cfg->battery = 0;
+	cfg->thumb = THUMB_SIZE;
+	faults_init(&cfg->faults);
+}
+
+int sim_option(SimConfig *cfg, const char *arg)
+{
+	if (!_strnicmp(arg, "pics=", 5))
+	{
+		cfg->pictures = atoi(arg+5);
+		return cfg->pictures >= 0 && cfg->pictures < 256 ? 1 : -1;
+	}
+	if (!_strnicmp(arg, "shoot=", 6))
+	{
+		cfg->shoot = (int)(atof(arg+6) * 1000);
+		return cfg->shoot > 0 ? 1 : -1;
+	}
+	if (!_strnicmp(arg, "battery=", 8))
+	{
+		cfg->battery = (int)(atof(arg+8) * 1000);
+		return cfg->battery > 0 ? 1 : -1;
+	}
+	if (!_strnicmp(arg, "thumb=", 6))
+	{
+		cfg->thumb = atoi(arg+6);
+		return cfg->thumb > 0 && cfg->thumb <= 32768 ? 1 : -1;
+	}
+	if (!_stricmp(arg, "both"))
+	{
+		cfg->both = 1;
+		return 1;
+	}
+	return faults_option(&cfg->faults, arg);
+}
+
+static unsigned char garble(unsigned char c)
+{
+	// What arrives when the two ends disagree on the baud rate, junk but repeatable
+	return (unsigned char)((c * 73 + 0x35) ^ 0xC3);
+}
+
+SimSerial::SimSerial(const SimConfig *config)
+{
+	cfg = *config;
+	FaultConfig none;
+	faults_init(&none);
+	up = new FaultInjector(cfg.both ? &cfg.faults : &none);
+	down = new FaultInjector(&cfg.faults);
+	rnd = 12345;		// Fixed so the card is the same whatever the fault seed
+
+	hostSpeed = camSpeed = CBR_9600;
+	hostLineFree = camLineFree = cameraFree = 0;
+	lastByte = 0;
+	nextShot = cfg.shoot;
+	resolution = 1;
+	totalTaken = 0;
+	pktSize = pktIdx = pktCount = pktDelay = 0;
+	memset(&times, 0, sizeof(times));
+	bytesUp = bytesDown = garbled = commands = 0;
+
+	for (int i=0; i<cfg.pictures; i++)
+	{
+		Picture p;
+		p.number = ++totalTaken;
+		p.resolution = Random() % 4 ? 1 : 0;
+		p.compression = 1 + Random() % 3;
+		p.size = p.resolution ? 100000 + Random() % 100000 : 40000 + Random() % 40000;
+		p.taken = SIM_CLOCK_START - (cfg.pictures - i) * 600 * DC210_TICKS_PER_SEC;
+		pictures.push_back(p);
+	}
+
+	clock_listen(Listen, this);
+}
+
+SimSerial::~SimSerial()
+{
+	clock_listen(NULL, NULL);
+	delete up;
+	delete down;
+}
+
+unsigned int SimSerial::Random()
+{
+	rnd ^= rnd << 13;
+	rnd ^= rnd >> 17;
+	rnd ^= rnd << 5;
+	return rnd;
+}
+
+// Time accounting
+
+void SimSerial::AddSpan(std::deque<Span> &spans, double from, double to)
+{
+	if (!spans.empty() && from <= spans.back().to)
+	{
+		if (to > spans.back().to)
+			spans.back().to = to;
+		if (from < spans.back().from)
+			spans.back().from = from;
+		return;
+	}
+	Span s;
+	s.from = from;
+	s.to = to;
+	spans.push_back(s);
+}
+
+double SimSerial::Overlap(std::deque<Span> &spans, double from, double to)
+{
+	double sum = 0;
+	for (size_t i=0; i<spans.size() && spans[i].from < to; i++)
+	{
+		double lo = spans[i].from > from ? spans[i].from : from;
+		double hi = spans[i].to < to ? spans[i].to : to;
+		if (hi > lo)
+			sum += hi - lo;
+	}
+	while (!spans.empty() && spans.front().to <= to)
+		spans.pop_front();
+	return sum;
+}
+
+void SimSerial::Listen(void *ctx, DWORD from, DWORD to)
+{
+	((SimSerial *)ctx)->Account(from, to);
+}
+
+void SimSerial::Account(DWORD from, DWORD to)
+{
+	// The line counts first, the camera only while the line is idle, the rest is the host's
+	double span = to - from;
+	double link = Overlap(linkSpans, from, to);
+	double camera = Overlap(cameraSpans, from, to);
+	if (camera > span - link)
+		camera = span - link;
+	times.link += link;
+	times.camera += camera;
+	times.host += span - link - camera;
+}
+
+// The line
+
+void SimSerial::Advance()
+{
+	double now = dc_ticks();
+
+	while (!toCamera.empty() && toCamera.front().at <= now)
+	{
+		WireByte b = toCamera.front();
+		toCamera.pop_front();
+		unsigned char c = b.c;
+		if (b.speed != camSpeed)
+		{
+			c = garble(c);
+			garbled++;
+		}
+		if (cfg.both)
+			up->Put((char *)&c, 1, (unsigned long)b.at);
+		else
+			Receive(c, b.at);
+	}
+	Shots(now);
+	if (cfg.both)
+	{
+		char buf[64];
+		int n;
+		while ((n = up->Get(buf, sizeof(buf), (unsigned long)now)) > 0)
+			for (int i=0; i<n; i++)
+				Receive((unsigned char)buf[i], now);
+	}
+
+	std::string ready;
+	while (!toHost.empty() && toHost.front().at <= now)
+	{
+		WireByte b = toHost.front();
+		toHost.pop_front();
+		if (b.speed != hostSpeed)
+		{
+			b.c = garble(b.c);
+			garbled++;
+		}
+		ready += (char)b.c;
+	}
+	if (!ready.empty())
+		down->Put(ready.data(), ready.size(), (unsigned long)now);
+}
+
+int SimSerial::ReadData(char *buffer, unsigned int nbChar)
+{
+	Advance();
+	int n = down->Get(buffer, nbChar, dc_ticks());
+	return n > 0 ? n : -1;
+}
+
+bool SimSerial::WriteData(char *buffer, unsigned int nbChar)
+{
+	Advance();
+	double now = dc_ticks();
+	for (unsigned int i=0; i<nbChar; i++)
+	{
+		double start = now > hostLineFree ? now : hostLineFree;
+		WireByte b;
+		b.at = start + 10000.0 / hostSpeed;		// 10 bits a byte
+		b.c = (unsigned char)buffer[i];
+		b.speed = hostSpeed;
+		AddSpan(linkSpans, start, b.at);
+		toCamera.push_back(b);
+		hostLineFree = b.at;
+		bytesUp++;
+	}
+	return true;
+}
+
+bool SimSerial::IsConnected()
+{
+	return true;
+}
+
+bool SimSerial::SetSpeed(int speed)
+{
+	Advance();		// Bytes already in arrived at the old speed
+	hostSpeed = speed;
+	dc_sleep(500);	// As serial.cpp
+	return true;
+}
+
+void SimSerial::FaultTotals(FaultStats *stats)
+{
+	*stats = down->stats;
+	stats->bytes += up->stats.bytes;
+	stats->corrupted += up->stats.corrupted;
+	stats->dropped += up->stats.dropped;
+	stats->fragments += up->stats.fragments;
+	stats->busy += up->stats.busy;
+	stats->delayms += up->stats.delayms;
+}
+
+// The camera
+
+double SimSerial::Emit(unsigned char c, double at)
+{
+	// Send a byte no earlier than at, returns when it has arrived
+	double start = at > camLineFree ? at : camLineFree;
+	WireByte b;
+	b.at = start + 10000.0 / camSpeed;
+	b.c = c;
+	b.speed = camSpeed;
+	AddSpan(linkSpans, start, b.at);
+	toHost.push_back(b);
+	camLineFree = b.at;
+	bytesDown++;
+	return b.at;
+}
+
+double SimSerial::Work(double at, int ms)
+{
+	// Camera busy for ms from at, sending DC_BUSY every so often. Returns when it is done
+	for (int t=SIM_BUSY_EVERY; t<ms; t+=SIM_BUSY_EVERY)
+		Emit(DC_BUSY, at + t);
+	AddSpan(cameraSpans, at, at + ms);
+	cameraFree = at + ms;
+	return cameraFree;
+}
+
+double SimSerial::Shoot(double at)
+{
+	// Take a picture, returns when it is stored
+	double done = at + SIM_TAKE_MS;
+	AddSpan(cameraSpans, at, done);
+	cameraFree = done;
+	Picture p;
+	p.number = ++totalTaken;
+	p.resolution = resolution;
+	p.compression = 1 + Random() % 3;
+	p.size = resolution ? 100000 + Random() % 100000 : 40000 + Random() % 40000;
+	p.taken = CameraTime(at);
+	if (pictures.size() < 255)		// numPictures is a byte
+		pictures.push_back(p);
+	return done;
+}
+
+void SimSerial::Shots(double upto)
+{
+	// Pictures taken at the camera itself (shoot=SECONDS). They wait while the camera is busy with
+	// a command, and are on the card once stored
+	while (cfg.shoot && !pktSize)
+	{
+		double at = nextShot > cameraFree ? nextShot : cameraFree;
+		if (at + SIM_TAKE_MS > upto)
+			break;
+		Shoot(at);
+		nextShot += cfg.shoot;
+	}
+}
+
+unsigned long SimSerial::CameraTime(double at)
+{
+	return SIM_CLOCK_START + (unsigned long)(at / 1000 * DC210_TICKS_PER_SEC);
+}
+
+void SimSerial::Receive(unsigned char c, double t)
+{
+	Shots(t);
+	if (!cmd.empty() && t - lastByte > SIM_GAP_MS)
+		cmd.erase();		// Partial command, start again
+	lastByte = t;
+	if (t < cameraFree)
+		t = cameraFree;		// Still working on the last one
+
+	if (pktSize && cmd.empty())
+	{
+		// Sending data, waiting for the host's verdict on the last packet
+		if (c == DC_CORRECT_PACKET)
+		{
+			if (++pktIdx < pktCount)
+				SendPacket(Work(t, pktDelay));
+			else
+			{
+				pktSize = 0;
+				Emit(DC_COMMAND_COMPLETE, Work(t, 1));
+			}
+			return;
+		}
+		if (c == DC_ILLEGAL_PACKET)
+		{
+			SendPacket(t);
+			return;
+		}
+		pktSize = 0;		// Cancelled, or the host has moved on
+		if (c == PKT_CTRL_CANCEL)
+		{
+			Emit(DC_COMMAND_COMPLETE, Work(t, 1));
+			return;
+		}
+	}
+	if (cmd.empty() && c == PKT_CTRL_CANCEL)
+		return;				// Nothing to cancel
+
+	cmd += (char)c;
+	if (cmd.size() == 8)
+	{
+		Command(cmd, t);
+		cmd.erase();
+	}
+}
+
+void SimSerial::Command(const std::string &c, double t)
+{
+	int code = (unsigned char)c[0];
+	int arg1 = (unsigned char)c[2];
+	int word = (arg1 << 8) | (unsigned char)c[3];
+	double at = Work(t, SIM_ACK_MS);
+	commands++;
+	down->Command();
+
+	if (c[1] != 0 || c[6] != 0 || (unsigned char)c[7] != 0x1A)
+	{
+		Emit(DC_COMMAND_NAK, at);
+		return;
+	}
+
+	switch (code)
+	{
+		case DC_SET_SPEED:
+		{
+			int speed = 0;
+			switch (word)
+			{
+				case 0x9600: speed = CBR_9600; break;
+				case 0x1920: speed = CBR_19200; break;
+				case 0x3840: speed = CBR_38400; break;
+				case 0x5760: speed = CBR_57600; break;
+				case 0x1152: speed = CBR_115200; break;
+			}
+			if (!speed)
+			{
+				Emit(DC_COMMAND_NAK, at);
+				return;
+			}
+			Emit(DC_COMMAND_ACK, at);
+			camSpeed = speed;		// Once the ACK has gone
+			return;
+		}
+		case DC210_INITIALIZE:
+			Emit(DC_COMMAND_ACK, at);
+			Emit(DC_COMMAND_COMPLETE, Work(at, SIM_INIT_MS));
+			return;
+		case DC210_STATUS:
+			Emit(DC_COMMAND_ACK, at);
+			pktDelay = 0;
+			StartData(Status(), 256, Work(at, SIM_STATUS_MS));
+			return;
+		case DC210_SET_RESOLUTION:
+			Emit(DC_COMMAND_ACK, at);
+			resolution = arg1 ? 1 : 0;
+			Emit(DC_COMMAND_COMPLETE, Work(at, 20));
+			return;
+		case DC210_TAKE_PICTURE:
+			Emit(DC_COMMAND_ACK, at);
+			Work(at, SIM_TAKE_MS);		// For the DC_BUSY
+			Emit(DC_COMMAND_COMPLETE, Shoot(at));
+			return;
+		case DC210_ERASE:
+		{
+			Emit(DC_COMMAND_ACK, at);
+			double done = Work(at, SIM_ERASE_MS * (1 + (int)pictures.size()));
+			pictures.clear();
+			Emit(DC_COMMAND_COMPLETE, done);
+			return;
+		}
+	}
+
+	// The rest take a picture number
+	if (word >= (int)pictures.size() ||
+		(code != DC210_PICTURE_INFO && code != DC210_PICTURE_DOWNLOAD &&
+		 code != DC210_PICTURE_THUMBNAIL && code != DC210_ERASE_IMAGE_IN_CARD))
+	{
+		Emit(DC_COMMAND_NAK, at);
+		return;
+	}
+	Emit(DC_COMMAND_ACK, at);
+	switch (code)
+	{
+		case DC210_PICTURE_INFO:
+			pktDelay = 0;
+			StartData(PictureInfo(word), 256, Work(at, SIM_INFO_MS));
+			break;
+		case DC210_PICTURE_DOWNLOAD:
+			pktDelay = SIM_PACKET_MS;
+			StartData(PictureData(word), 1024, Work(at, SIM_CARD_MS));
+			break;
+		case DC210_PICTURE_THUMBNAIL:
+			pktDelay = 0;
+			StartData(Thumbnail(word), 1024, Work(at, SIM_THUMB_MS));
+			break;
+		case DC210_ERASE_IMAGE_IN_CARD:
+		{
+			double done = Work(at, SIM_ERASE_MS);
+			pictures.erase(pictures.begin() + word);
+			Emit(DC_COMMAND_COMPLETE, done);
+			break;
+		}
+	}
+}
+
+void SimSerial::StartData(const std::string &data, int size, double at)
+{
+	pktSize = size;
+	pktIdx = 0;
+	pktCount = ((int)data.size() + size - 1) / size;
+	payload = data;
+	payload.resize(pktCount * size, 0);		// Last packet is padded
+	SendPacket(at);
+}
+
+double SimSerial::SendPacket(double at)
+{
+	const char *p = payload.data() + pktIdx * pktSize;
+	unsigned char checksum = 0;
+	Emit(PKT_CTRL_RECV, at);
+	for (int i=0; i<pktSize; i++)
+	{
+		checksum ^= (unsigned char)p[i];
+		Emit((unsigned char)p[i], at);
+	}
+	return Emit(checksum, at);
+}
+
+static void put_be(std::string &s, int pos, unsigned long v, int len)
+{
+	for (int i=len-1; i>=0; i--, v >>= 8)
+		s[pos+i] = (char)(v & 0xFF);
+}
+
+std::string SimSerial::Status()
+{
+	std::string s(256, '\0');
+	s[1] = 5;						// cameraTypeId
+	s[2] = 1;						// Firmware 1.0
+	if (cfg.battery)
+	{
+		DWORD now = dc_ticks();
+		s[8] = now < (DWORD)cfg.battery ? DC210_BATTERY_OK : now < 2 * (DWORD)cfg.battery ? DC210_BATTERY_LOW : DC210_BATTERY_EMPTY;
+		s[9] = 0;
+	}
+	else
+	{
+		s[8] = DC210_BATTERY_OK;
+		s[9] = DC210_AC_CONNECTED;
+	}
+	put_be(s, 12, CameraTime(dc_ticks()), 4);
+	s[22] = (char)resolution;
+	put_be(s, 25, totalTaken, 2);
+	s[57] = (char)pictures.size();
+	memcpy(&s[90], "SIMULATED DC210", 15);
+	return s;
+}
+
+std::string SimSerial::PictureInfo(int n)
+{
+	Picture &p = pictures[n];
+	std::string s(256, '\0');
+	char name[13];
+	sprintf(name, "DCP%05d.JPG", p.number % 100000);
+	s[3] = (char)p.resolution;
+	s[4] = (char)p.compression;
+	put_be(s, 6, n, 2);
+	put_be(s, 8, p.size, 4);
+	put_be(s, 12, p.taken, 4);
+	memcpy(&s[32], name, 12);
+	return s;
+}
+
+std::string SimSerial::PictureData(int n)
+{
+	// Enough of a jpeg to look like one: SOI, APP0 JFIF, SOS, entropy coded data with no
+	// markers in it, EOI. The content depends only on the picture's number
+	Picture &p = pictures[n];
+	static const unsigned char head[] =
+	{
+		0xFF, 0xD8,
+		0xFF, 0xE0, 0x00, 0x10, 'J', 'F', 'I', 'F', 0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00,
+		0xFF, 0xDA, 0x00, 0x08, 0x01, 0x01, 0x00, 0x00, 0x3F, 0x00
+	};
+	std::string s((const char *)head, sizeof(head));
+	s.resize(p.size - 2);
+	unsigned int r = p.number * 2654435761U;
+	for (int i=sizeof(head); i<p.size-2; i++)
+	{
+		r = r * 1103515245 + 12345;
+		unsigned char c = (unsigned char)(r >> 16);
+		s[i] = (char)(c == 0xFF ? 0xFE : c);
+	}
+	s += (char)0xFF;
+	s += (char)0xD9;
+	return s;
+}
+
+std::string SimSerial::Thumbnail(int n)
+{
+	// 96x72 RGB top row first (see thumb.h), a gradient tinted by the picture's number
+	Picture &p = pictures[n];
+	std::string s(THUMB_SIZE, '\0');
+	for (int y=0; y<THUMB_HEIGHT; y++)
+		for (int x=0; x<THUMB_WIDTH; x++)
+		{
+			char *px = &s[(y*THUMB_WIDTH + x) * 3];
+			px[0] = (char)(x * 255 / (THUMB_WIDTH-1));
+			px[1] = (char)(y * 255 / (THUMB_HEIGHT-1));
+			px[2] = (char)(p.number * 40);
+		}
+	s.resize(cfg.thumb, '\0');
+	return s;
+}
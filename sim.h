@@ -0,0 +1,130 @@
+// sim.h	- Simulated DC210 on a simulated serial line, run in virtual time (see clock.h)
+
+#ifndef SIM_H_INCLUDED
+#define SIM_H_INCLUDED
+
+#include <deque>
+#include <string>
+#include <vector>
+#include "SerialClass.h"
+#include "faults.h"
+
+// Stands in for the port and the camera so a whole session runs in virtual time. Every byte
+// takes its real time on the wire at the current baud rate of each end (a mismatch garbles
+// it, as a real one does), the camera takes time to process each command, and faults.cpp
+// supplies line noise etc. Camera timings are plausible guesses, not measurements.
+
+struct SimConfig
+{
+	int pictures;			// On the card at the start
+	int shoot;				// ms between pictures taken at the camera (as by an operator), 0 for none
+	int both;				// Apply faults host -> camera as well
+	int battery;			// ms on battery before it is low (empty at twice that), 0 for on AC
+	int thumb;				// Bytes in a thumbnail, as a camera with another format
+	FaultConfig faults;		// camera -> host
+};
+
+void sim_init(SimConfig *cfg);
+
+// Parse a command line word, pics=N shoot=SECONDS battery=SECONDS thumb=BYTES both or any fault option (see faults.h). Returns 1 if it was
+// a simulator option, 0 if not, -1 if the value is bad
+int sim_option(SimConfig *cfg, const char *arg);
+
+// Where the virtual time went, in ms
+struct SimTimes
+{
+	double link;		// Bytes on the wire (either way)
+	double camera;		// Camera working with the line idle
+	double host;		// Neither, ie the host's own sleeps and polling
+};
+
+class SimSerial : public Serial
+{
+	private:
+		struct WireByte
+		{
+			double at;			// Arrival at the far end
+			unsigned char c;
+			int speed;			// Baud it was sent at
+		};
+		struct Span
+		{
+			double from, to;
+		};
+		struct Picture
+		{
+			int number;				// For the file name, kept across erases
+			int size;
+			int resolution;
+			int compression;
+			unsigned long taken;	// Camera ticks (DC210_TICKS_PER_SEC)
+		};
+
+		SimConfig cfg;
+		FaultInjector *up;			// host -> camera
+		FaultInjector *down;		// camera -> host
+		unsigned int rnd;
+
+		int hostSpeed;
+		int camSpeed;
+		std::deque<WireByte> toCamera;
+		std::deque<WireByte> toHost;
+		double hostLineFree;		// When the last byte each way finishes
+		double camLineFree;
+		double cameraFree;			// When the camera finishes what it is doing
+
+		std::deque<Span> linkSpans;		// Not yet accounted for, see Account()
+		std::deque<Span> cameraSpans;
+
+		// Camera
+		std::string cmd;
+		double lastByte;
+		double nextShot;
+		std::vector<Picture> pictures;
+		int resolution;
+		int totalTaken;
+		std::string payload;		// Data being sent in packets
+		int pktSize;
+		int pktIdx;
+		int pktCount;
+		int pktDelay;				// ms to ready each packet after the first
+
+		unsigned int Random();
+		static void AddSpan(std::deque<Span> &spans, double from, double to);
+		static double Overlap(std::deque<Span> &spans, double from, double to);
+		static void Listen(void *ctx, DWORD from, DWORD to);
+		void Account(DWORD from, DWORD to);
+
+		void Advance();
+		void Receive(unsigned char c, double t);
+		void Command(const std::string &c, double t);
+		double Emit(unsigned char c, double at);
+		double Work(double at, int ms);
+		double Shoot(double at);
+		void Shots(double upto);
+		void StartData(const std::string &data, int size, double at);
+		double SendPacket(double at);
+		unsigned long CameraTime(double at);
+		std::string Status();
+		std::string PictureInfo(int n);
+		std::string PictureData(int n);
+		std::string Thumbnail(int n);
+
+	public:
+		SimTimes times;
+		long bytesUp;			// host -> camera
+		long bytesDown;
+		long garbled;			// Bytes received at the wrong baud rate
+		long commands;
+
+		SimSerial(const SimConfig *config);
+		~SimSerial();
+		int ReadData(char *buffer, unsigned int nbChar);
+		bool WriteData(char *buffer, unsigned int nbChar);
+		bool IsConnected();
+		bool SetSpeed(int speed);
+		// Faults injected both ways
+		void FaultTotals(FaultStats *stats);
+};
+
+#endif // SIM_H_INCLUDED
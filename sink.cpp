@@ -0,0 +1,335 @@
+// sink.cpp	- Output sinks for downloaded pictures (separate files, tar, zip, stdout)
+
+// Tar is plain POSIX ustar. Zip uses the stored method, with the crc patched into the local
+// header after the data when the output is seekable, else a data descriptor (bit 3) is appended
+// which is what allows streaming a zip to a pipe.
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <io.h>
+#include <fcntl.h>
+#include <vector>
+#include <string>
+#include "sink.h"
+#include "dc210.h"		// myprintf
+
+static FILE *open_out(const char *path)
+{
+	if (!strcmp(path, "-"))
+	{
+		_setmode(_fileno(stdout), _O_BINARY);	// Else windows mangles 0x0A bytes
+		return stdout;
+	}
+	FILE *f = fopen(path, "wb");
+	if (!f)
+		(VERBOSITY > -1) && myprintf("ERROR opening output file %s\n", path);
+	return f;
+}
+
+static void close_out(FILE *f)
+{
+	if (f == stdout)
+		fflush(f);
+	else
+		fclose(f);
+}
+
+// Separate files in the current or given directory (or all concatenated on stdout)
+
+class FileSink : public Sink
+{
+	private:
+		FILE *ofile;
+		bool to_stdout;
+		std::string dir;
+	public:
+		FileSink(const char *path) : ofile(NULL), to_stdout(false)
+		{
+			if (path && !strcmp(path, "-"))
+				to_stdout = true;
+			else if (path)
+			{
+				dir = path;
+				if (dir[dir.size()-1] != '\\' && dir[dir.size()-1] != '/')
+					dir += '\\';
+			}
+		}
+
+		bool Begin(const char *name, int size, long mtime)
+		{
+			if (to_stdout)
+			{
+				ofile = open_out("-");		// Binary mode, as for the archives
+				return true;
+			}
+			std::string fname = dir + name;
+			ofile = fopen(fname.c_str(), "wb");
+			if (!ofile)
+			{
+				(VERBOSITY > -1) && myprintf("ERROR opening output file %s\n", fname.c_str());
+				return false;
+			}
+			return true;
+		}
+
+		bool Write(const char *data, int len)
+		{
+			return fwrite(data, 1, len, ofile) == (size_t)len;
+		}
+
+		bool End()
+		{
+			if (!ofile)
+				return false;
+			close_out(ofile);
+			ofile = NULL;
+			return true;
+		}
+
+		bool Close()
+		{
+			return true;
+		}
+};
+
+// Tar (ustar)
+
+class TarSink : public Sink
+{
+	private:
+		FILE *ofile;
+		int written;	// Bytes of current entry, for padding to 512
+	public:
+		TarSink(FILE *f) : ofile(f), written(0) {}
+
+		bool Begin(const char *name, int size, long mtime)
+		{
+			char hdr[512];
+			memset(hdr, 0, sizeof(hdr));
+			strncpy(hdr, name, 99);
+			sprintf(hdr+100, "%07o", 0644);
+			sprintf(hdr+108, "%07o", 0);
+			sprintf(hdr+116, "%07o", 0);
+			sprintf(hdr+124, "%011o", size);
+			sprintf(hdr+136, "%011lo", (unsigned long)mtime);
+			memset(hdr+148, ' ', 8);	// Checksum is computed with its own field as spaces
+			hdr[156] = '0';
+			memcpy(hdr+257, "ustar", 6);
+			memcpy(hdr+263, "00", 2);
+
+			unsigned int sum = 0;
+			for (int i=0; i<512; i++)
+				sum += (unsigned char)hdr[i];
+			sprintf(hdr+148, "%06o", sum);	// Six digits, NUL, space
+			hdr[155] = ' ';
+
+			written = 0;
+			return fwrite(hdr, 1, 512, ofile) == 512;
+		}
+
+		bool Write(const char *data, int len)
+		{
+			written += len;
+			return fwrite(data, 1, len, ofile) == (size_t)len;
+		}
+
+		bool End()
+		{
+			static const char pad[512] = {0};
+			int padlen = (512 - written % 512) % 512;
+			return fwrite(pad, 1, padlen, ofile) == (size_t)padlen;
+		}
+
+		bool Close()
+		{
+			static const char trailer[1024] = {0};	// Two empty blocks
+			bool ok = fwrite(trailer, 1, sizeof(trailer), ofile) == sizeof(trailer);
+			close_out(ofile);
+			return ok;
+		}
+};
+
+// Zip (stored)
+
+static unsigned int crc_table[256];
+
+static void make_crc_table()
+{
+	for (unsigned int n=0; n<256; n++)
+	{
+		unsigned int c = n;
+		for (int k=0; k<8; k++)
+			c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+		crc_table[n] = c;
+	}
+}
+
+static void put16(char *p, int v)
+{
+	p[0] = v & 0xFF;
+	p[1] = (v >> 8) & 0xFF;
+}
+
+static void put32(char *p, unsigned int v)
+{
+	put16(p, v & 0xFFFF);
+	put16(p+2, (v >> 16) & 0xFFFF);
+}
+
+struct ZipEntry
+{
+	std::string name;
+	unsigned int crc;
+	int size;
+	long offset;	// Of local header
+	int dostime;
+	int dosdate;
+	int flags;
+};
+
+class ZipSink : public Sink
+{
+	private:
+		FILE *ofile;
+		bool seekable;
+		long pos;		// Track position ourselves since stdout can't ftell
+		unsigned int crc;
+		std::vector<ZipEntry> entries;
+	public:
+		ZipSink(FILE *f) : ofile(f), pos(0), crc(0)
+		{
+			seekable = (f != stdout);
+			if (!crc_table[1])
+				make_crc_table();
+		}
+
+		bool Begin(const char *name, int size, long mtime)
+		{
+			ZipEntry e;
+			e.name = name;
+			e.crc = 0;
+			e.size = size;
+			e.offset = pos;
+			e.flags = seekable ? 0 : 0x0008;
+
+			time_t t = mtime;
+			struct tm *tm = localtime(&t);
+			if (tm && tm->tm_year >= 80)
+			{
+				e.dostime = (tm->tm_hour << 11) | (tm->tm_min << 5) | (tm->tm_sec / 2);
+				e.dosdate = ((tm->tm_year - 80) << 9) | ((tm->tm_mon + 1) << 5) | tm->tm_mday;
+			}
+			else
+			{
+				e.dostime = 0;
+				e.dosdate = (1 << 5) | 1;	// 1 Jan 1980
+			}
+
+			char hdr[30];
+			put32(hdr, 0x04034b50);
+			put16(hdr+4, 20);			// Version needed
+			put16(hdr+6, e.flags);
+			put16(hdr+8, 0);			// Stored
+			put16(hdr+10, e.dostime);
+			put16(hdr+12, e.dosdate);
+			put32(hdr+14, 0);			// crc, patched or in data descriptor
+			put32(hdr+18, size);		// Sizes are known up front from PICTURE_INFO
+			put32(hdr+22, size);
+			put16(hdr+26, e.name.size());
+			put16(hdr+28, 0);
+
+			entries.push_back(e);
+			crc = 0xFFFFFFFF;
+			pos += 30 + e.name.size();
+			return fwrite(hdr, 1, 30, ofile) == 30 &&
+				   fwrite(name, 1, e.name.size(), ofile) == e.name.size();
+		}
+
+		bool Write(const char *data, int len)
+		{
+			for (int i=0; i<len; i++)
+				crc = crc_table[(crc ^ (unsigned char)data[i]) & 0xFF] ^ (crc >> 8);
+			pos += len;
+			return fwrite(data, 1, len, ofile) == (size_t)len;
+		}
+
+		bool End()
+		{
+			ZipEntry &e = entries.back();
+			e.crc = crc ^ 0xFFFFFFFF;
+			char buf[16];
+			if (seekable)
+			{
+				put32(buf, e.crc);
+				fseek(ofile, e.offset + 14, SEEK_SET);
+				bool ok = fwrite(buf, 1, 4, ofile) == 4;
+				fseek(ofile, pos, SEEK_SET);
+				return ok;
+			}
+			put32(buf, 0x08074b50);
+			put32(buf+4, e.crc);
+			put32(buf+8, e.size);
+			put32(buf+12, e.size);
+			pos += 16;
+			return fwrite(buf, 1, 16, ofile) == 16;
+		}
+
+		bool Close()
+		{
+			bool ok = true;
+			long cdstart = pos;
+			char hdr[46];
+			for (size_t i=0; i<entries.size(); i++)
+			{
+				ZipEntry &e = entries[i];
+				put32(hdr, 0x02014b50);
+				put16(hdr+4, 20);		// Version made by (MSDOS)
+				put16(hdr+6, 20);
+				put16(hdr+8, e.flags);
+				put16(hdr+10, 0);
+				put16(hdr+12, e.dostime);
+				put16(hdr+14, e.dosdate);
+				put32(hdr+16, e.crc);
+				put32(hdr+20, e.size);
+				put32(hdr+24, e.size);
+				put16(hdr+28, e.name.size());
+				put16(hdr+30, 0);		// Extra
+				put16(hdr+32, 0);		// Comment
+				put16(hdr+34, 0);		// Disk
+				put16(hdr+36, 0);		// Internal attr
+				put32(hdr+38, 0);		// External attr
+				put32(hdr+42, e.offset);
+				ok = ok && fwrite(hdr, 1, 46, ofile) == 46;
+				ok = ok && fwrite(e.name.c_str(), 1, e.name.size(), ofile) == e.name.size();
+				pos += 46 + e.name.size();
+			}
+
+			char end[22];
+			put32(end, 0x06054b50);
+			put16(end+4, 0);
+			put16(end+6, 0);
+			put16(end+8, entries.size());
+			put16(end+10, entries.size());
+			put32(end+12, pos - cdstart);
+			put32(end+16, cdstart);
+			put16(end+20, 0);
+			ok = ok && fwrite(end, 1, 22, ofile) == 22;
+			close_out(ofile);
+			return ok;
+		}
+};
+
+Sink *open_sink(int type, const char *path)
+{
+	if (type == SINK_FILES)
+		return new FileSink(path);
+
+	FILE *f = open_out(path);
+	if (!f)
+		return NULL;
+
+	if (type == SINK_TAR)
+		return new TarSink(f);
+	return new ZipSink(f);
+}
@@ -0,0 +1,35 @@
+// sink.h	- Output sinks for downloaded pictures (separate files, tar, zip, stdout)
+
+#ifndef SINK_H_INCLUDED
+#define SINK_H_INCLUDED
+
+#include <stdio.h>
+
+#define SINK_FILES	0		// One file per picture (the original behaviour)
+#define SINK_TAR	1		// Single ustar archive
+#define SINK_ZIP	2		// Single zip archive (stored, no compression as jpegs don't shrink)
+
+// Each picture is collected in memory (fullData in main.cpp) and only once the transfer is complete
+// is it passed on, as Begin() with its size, Write() and End(). A transfer can be abandoned for a
+// more urgent one (see sched.h) and must not leave half an entry in a tar or zip, so pictures are
+// no longer streamed block by block. Nothing is staged in temp files, which is what allows
+// writing an archive to stdout.
+
+class Sink
+{
+	public:
+		virtual ~Sink() {}
+		// Start a new entry. size is exact (pi_fileSize), mtime is unix time
+		virtual bool Begin(const char *name, int size, long mtime) = 0;
+		virtual bool Write(const char *data, int len) = 0;
+		virtual bool End() = 0;
+		// Write any archive trailer and close the output
+		virtual bool Close() = 0;
+};
+
+// path "-" means stdout (switched to binary mode). For SINK_FILES the path is the directory to
+// write to (NULL for the current one), or "-" to simply concatenate the pictures on stdout.
+// Returns NULL on failure (message already printed)
+Sink *open_sink(int type, const char *path);
+
+#endif // SINK_H_INCLUDED
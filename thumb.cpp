@@ -0,0 +1,150 @@
+// thumb.cpp	- Camera thumbnails (DC210_PICTURE_THUMBNAIL) to BMP images
+
+#include <string.h>
+#include "thumb.h"
+#include "pool.h"
+
+#if defined(_M_IX86) || defined(_M_X64)
+#define THUMB_SSSE3
+#include <intrin.h>
+#include <tmmintrin.h>
+#endif
+
+static void put16(char *p, int v)
+{
+	p[0] = v & 0xFF;
+	p[1] = (v >> 8) & 0xFF;
+}
+
+static void put32(char *p, unsigned int v)
+{
+	put16(p, v & 0xFFFF);
+	put16(p+2, (v >> 16) & 0xFFFF);
+}
+
+static int bmp_stride(int width)
+{
+	return (width * 3 + 3) & ~3;
+}
+
+static void bmp_header(char *bmp, int width, int height)
+{
+	// BITMAPFILEHEADER then BITMAPINFOHEADER
+	int image = bmp_stride(width) * height;
+	memset(bmp, 0, 54);
+	bmp[0] = 'B';
+	bmp[1] = 'M';
+	put32(bmp+2, 54 + image);
+	put32(bmp+10, 54);
+	put32(bmp+14, 40);
+	put32(bmp+18, width);
+	put32(bmp+22, height);
+	put16(bmp+26, 1);
+	put16(bmp+28, 24);
+	put32(bmp+34, image);
+}
+
+#ifdef THUMB_SSSE3
+static int has_ssse3()
+{
+	static int has = -1;
+	if (has < 0)
+	{
+		int info[4];
+		__cpuid(info, 1);
+		has = (info[2] >> 9) & 1;	// ECX bit 9
+	}
+	return has;
+}
+#endif
+
+void thumb_row(const char *rgb, char *bgr, int pixels)
+{
+#ifdef THUMB_SSSE3
+	if (has_ssse3())
+	{
+		// 5 pixels per 16 byte shuffle, the 16th byte is copied as is and then overwritten by the
+		// next step, so stop while there is a 6th pixel to cover it
+		const __m128i swap = _mm_setr_epi8(2,1,0, 5,4,3, 8,7,6, 11,10,9, 14,13,12, 15);
+		for (; pixels > 5; pixels -= 5, rgb += 15, bgr += 15)
+			_mm_storeu_si128((__m128i*)bgr, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)rgb), swap));
+	}
+#endif
+	for (; pixels > 0; pixels--, rgb += 3, bgr += 3)
+	{
+		bgr[0] = rgb[2];
+		bgr[1] = rgb[1];
+		bgr[2] = rgb[0];
+	}
+}
+
+void thumb_to_bmp(const char *rgb, char *bmp)
+{
+	bmp_header(bmp, THUMB_WIDTH, THUMB_HEIGHT);
+	char *out = bmp + 54;
+	for (int y=THUMB_HEIGHT-1; y>=0; y--, out += THUMB_WIDTH * 3)
+		thumb_row(rgb + y * THUMB_WIDTH * 3, out, THUMB_WIDTH);
+}
+
+ContactSheet::ContactSheet(ThreadPool *pool) : pool(pool)
+{
+}
+
+ContactSheet::~ContactSheet()
+{
+	pool->Wait();
+	for (size_t i=0; i<tiles.size(); i++)
+		delete tiles[i];
+}
+
+void ContactSheet::Convert(void *p)
+{
+	Tile *tile = (Tile*)p;
+	char *out = tile->bgr;
+	for (int y=THUMB_HEIGHT-1; y>=0; y--, out += THUMB_WIDTH * 3)
+		thumb_row(tile->rgb + y * THUMB_WIDTH * 3, out, THUMB_WIDTH);
+}
+
+void ContactSheet::Add(const char *rgb)
+{
+	Tile *tile = new Tile;
+	memcpy(tile->rgb, rgb, THUMB_SIZE);
+	tiles.push_back(tile);
+	pool->Run(Convert, tile);
+}
+
+int ContactSheet::Finish()
+{
+	pool->Wait();
+
+	int n = (int)tiles.size();
+	int columns = n < SHEET_COLUMNS ? (n ? n : 1) : SHEET_COLUMNS;
+	int rows = n ? (n + columns - 1) / columns : 1;
+	int width = columns * THUMB_WIDTH + (columns + 1) * SHEET_GAP;
+	int height = rows * THUMB_HEIGHT + (rows + 1) * SHEET_GAP;
+	int stride = bmp_stride(width);
+
+	bmp.assign(54 + stride * height, (char)SHEET_GREY);
+	bmp_header(&bmp[0], width, height);
+	char *image = &bmp[54];
+	for (int i=0; i<n; i++)
+	{
+		// Rows are counted from the top of the sheet, the BMP goes from the bottom
+		int x = SHEET_GAP + (i % columns) * (THUMB_WIDTH + SHEET_GAP);
+		int top = SHEET_GAP + (i / columns) * (THUMB_HEIGHT + SHEET_GAP);
+		int bottom = height - top - THUMB_HEIGHT;
+		for (int y=0; y<THUMB_HEIGHT; y++)
+			memcpy(image + (bottom + y) * stride + x * 3, tiles[i]->bgr + y * THUMB_WIDTH * 3, THUMB_WIDTH * 3);
+	}
+	return (int)bmp.size();
+}
+
+const char *ContactSheet::Data()
+{
+	return bmp.empty() ? NULL : &bmp[0];
+}
+
+int ContactSheet::Count()
+{
+	return (int)tiles.size();
+}
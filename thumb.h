@@ -0,0 +1,51 @@
+// thumb.h	- Camera thumbnails (DC210_PICTURE_THUMBNAIL) to BMP images
+
+#ifndef THUMB_H_INCLUDED
+#define THUMB_H_INCLUDED
+
+#include <vector>
+
+class ThreadPool;
+
+// The low resolution thumbnail is taken to be 96x72, 8 bit RGB, top row first
+#define THUMB_WIDTH		96
+#define THUMB_HEIGHT	72
+#define THUMB_SIZE		(THUMB_WIDTH * THUMB_HEIGHT * 3)
+#define THUMB_BMP_SIZE	(54 + THUMB_SIZE)		// Rows of 288 bytes need no padding
+
+#define SHEET_COLUMNS	8
+#define SHEET_GAP		4		// Pixels around each thumbnail
+#define SHEET_GREY		0x80
+
+// Make a complete 24 bit BMP file image (BGR, bottom row first) of THUMB_BMP_SIZE bytes
+void thumb_to_bmp(const char *rgb, char *bmp);
+
+// Swap RGB pixels to BGR (SSSE3 when the processor has it)
+void thumb_row(const char *rgb, char *bgr, int pixels);
+
+// All of a card's thumbnails in one BMP, SHEET_COLUMNS across in the order added. Each one is
+// converted on the pool as it is added so the work is done by the time the last one arrives
+class ContactSheet
+{
+	private:
+		struct Tile
+		{
+			char rgb[THUMB_SIZE];
+			char bgr[THUMB_SIZE];		// Bottom row first
+		};
+		std::vector<Tile*> tiles;
+		std::vector<char> bmp;
+		ThreadPool *pool;
+		static void Convert(void *tile);
+	public:
+		ContactSheet(ThreadPool *pool);
+		~ContactSheet();
+		// Copies the THUMB_SIZE bytes of rgb
+		void Add(const char *rgb);
+		// Wait for the conversions and lay out the BMP, returns its size in bytes
+		int Finish();
+		const char *Data();
+		int Count();
+};
+
+#endif // THUMB_H_INCLUDED